@@ -37,12 +37,23 @@ local ecs_term_t = {}
 ---@field expr string
 local ecs_filter_t = {}
 
+---Filter initialized by ecs.filter()
+---@class ecs_compiled_filter_t
+local ecs_compiled_filter_t = {}
+
 ---@class ecs_query_t
 local ecs_query_t = {}
 
 ---@class ecs_snapshot_t
 local ecs_snapshot_t = {}
 
+---Options for systems, triggers and observers
+---@class ecs_callback_opts_t
+---@field proxy boolean @it.columns[i] are views over component memory, writes are applied in place
+---@field track boolean @only rows with assigned members are written back after the callback
+---@field multi_threaded boolean @system runs on worker threads, see ecs.load_stages()
+local ecs_callback_opts_t = {}
+
 ---@class ecs_iter_t
 ---@field count integer
 ---@field system integer
@@ -59,6 +70,41 @@ local ecs_snapshot_t = {}
 ---@field term_index integer
 local ecs_iter_t = {}
 
+---Same as ecs.field_array(it, term, member)
+---@param term integer
+---@param member string
+---@return number[]
+function ecs_iter_t:field_array(term, member)
+end
+
+---Same as ecs.set_field_array(it, term, member, values)
+---@param term integer
+---@param member string
+---@param values number[]
+function ecs_iter_t:set_field_array(term, member, values)
+end
+
+---Get a member of the term with the handle's component
+---@param member ecs_member_t
+---@param row? integer @defaults to the current row of ecs.each()
+---@return any
+function ecs_iter_t:getm(member, row)
+end
+
+---Set a member of the term with the handle's component
+---@param member ecs_member_t
+---@param row? integer @defaults to the current row of ecs.each()
+---@param value any
+function ecs_iter_t:setm(member, row, value)
+end
+
+---@class ecs_member_t
+local ecs_member_t = {}
+
+---Compact array of entity ID's, supports indexing, # and ipairs()
+---@class ecs_range_t
+local ecs_range_t = {}
+
 ---Create a new entity
 ---@param entity integer
 ---@param name string
@@ -257,7 +303,7 @@ function ecs.disable(entity, component)
 end
 
 ---Count entities that have a component, type, tag or match a filter
----@param param integer|ecs_type_t|ecs_filter_t
+---@param param integer|ecs_type_t|ecs_filter_t|ecs_compiled_filter_t
 ---@return integer
 function ecs.count(param)
 end
@@ -498,10 +544,12 @@ function ecs.alias(meta_type, alias)
 end
 
 ---Get the value of an entity's component,
----returns nil if the entity does not have the component
+---returns nil if the entity does not have the component.
+---Components of a single primitive type, e.g. ecs.alias("flecs.meta.f32", "Health"),
+---are bare numbers, booleans or strings here and everywhere else values are passed
 ---@param entity integer
 ---@param component integer
----@return table|nil
+---@return table|number|boolean|string|nil
 function ecs.get(entity, component)
 end
 
@@ -526,13 +574,91 @@ end
 ---Set the value of a component,
 ---equivalent to ecs.get_mut() + ecs.modified(),
 ---it does not trigger the `copy` component action
+---Vector members are resized to the length of the sequence, map members are replaced by the table
 ---@param entity integer
 ---@param component integer
----@param v table
+---@param v table|number|boolean|string
 ---@return integer entity
 function ecs.set(entity, component, v)
 end
 
+---Set a component for many entities, the type is resolved once for all of them.
+---values is either an array of values parallel to entities or a single value for all entities
+---@param entities integer[]|ecs_range_t
+---@param component integer
+---@param values any @a table is always an array of values for single-primitive components
+---@return integer @number of entities
+function ecs.set_many(entities, component, values)
+end
+
+---Queue ecs.add(), ecs.remove(), ecs.delete() and the setters (ecs.set(), ecs.set_many(),
+---ecs.set_fields(), ecs.setm()) until the matching ecs.defer_end(), other operations
+---(ecs.bulk_new(), ...) are deferred by the world and applied before the queue,
+---regardless of call order. Calls can be nested
+function ecs.defer_begin()
+end
+
+---End deferred mode, the outermost call applies the queue:
+---operations are grouped per entity, added and removed ids are applied in one table
+---transition each, an add followed by a remove is dropped and consecutive sets are merged.
+---A remove followed by an add or set resets the component. An entity is only deleted
+---after the queued operations of other entities that reference it
+---Values passed to ecs.set() are copied when they are queued
+---@return integer @number of queued operations, 0 for nested calls
+function ecs.defer_end()
+end
+
+---@return boolean
+function ecs.is_deferred()
+end
+
+---Call func between ecs.defer_begin() and ecs.defer_end(),
+---the queue is applied even if func raises an error, which is then re-raised
+---@param func function
+---@vararg any @arguments for func
+---@return any @results of func
+function ecs.batch(func, ...)
+end
+
+---Get a handle for a primitive member of a component,
+---resolved once for use with ecs.getm(), ecs.setm() and it:getm()/it:setm()
+---@param component integer
+---@param member string @member path, e.g. "pos.x"
+---@return ecs_member_t
+function ecs.member(component, member)
+end
+
+---Get a single member of a component
+---@param entity integer
+---@param member ecs_member_t
+---@return any @nil if the entity does not have the component
+function ecs.getm(entity, member)
+end
+
+---Set a single member of a component, the component is added if not present
+---@param entity integer
+---@param member ecs_member_t
+---@param value any
+function ecs.setm(entity, member, value)
+end
+
+---Get the members of a component as values, in declaration order
+---(nested structs are expanded), without creating a table
+---@param entity integer
+---@param component integer
+---@return any ... @nil if the entity does not have the component
+function ecs.get_fields(entity, component)
+end
+
+---Set the members of a component from values, in declaration order
+---(nested structs are expanded), nil values leave the member unchanged
+---@param entity integer
+---@param component integer
+---@vararg any
+---@return integer entity
+function ecs.set_fields(entity, component, ...)
+end
+
 ---Create a new reference
 ---@param entity integer
 ---@param component integer
@@ -585,7 +711,7 @@ end
 ---Create a scope iterator
 ---@overload fun(parent: integer)
 ---@param parent integer
----@param filter ecs_filter_t
+---@param filter ecs_filter_t|ecs_compiled_filter_t
 ---@return ecs_iter_t
 function ecs.scope_iter(parent, filter)
 end
@@ -613,15 +739,17 @@ end
 function ecs.set_name_prefix(prefix)
 end
 
----Create N new entities with an optional component
+---Create N new entities with an optional component and initial data
 ---@overload fun(n: integer)
----@overload fun(n: integer, noreturn: boolean)
+---@overload fun(n: integer, noreturn: boolean|string)
 ---@overload fun(type: integer, count: integer)
+---@overload fun(type: integer, count: integer, noreturn: boolean|string)
 ---@param type integer @optional
 ---@param n integer
----@param noreturn boolean @do not return the entity ID's
----@return integer[]|nil
-function ecs.bulk_new(type, n, noreturn)
+---@param data table<integer, table> @optional, component => array of values or one value for all entities
+---@param noreturn boolean|string @do not return the entity ID's, "range" returns an ecs_range_t
+---@return integer[]|ecs_range_t|nil
+function ecs.bulk_new(type, n, data, noreturn)
 end
 
 local Component = ecs.lookup("Component")
@@ -633,9 +761,14 @@ ecs.bulk_new(Component, 10)
 ecs.bulk_new(10, true)
 ecs.bulk_new(Component, 10, true)
 
+--Component columns are filled before the entities are returned
+local Position = ecs.lookup("Position")
+ecs.bulk_new(0, 3, { [Position] = { {x = 1}, {x = 2}, {x = 3} } })
+ecs.bulk_new(Component, 1000, { [Position] = { x = 0, y = 0 } }, "range")
+
 ---Delete entities matching a filter
 ---@overload fun()
----@param filter ecs_filter_t
+---@param filter ecs_filter_t|ecs_compiled_filter_t
 function ecs.bulk_delete(filter)
 end
 
@@ -658,6 +791,23 @@ end
 function ecs.is_owned(it, column)
 end
 
+---Get one numeric member of a term for all rows of the iterator
+---@param it ecs_iter_t
+---@param term integer
+---@param member string @member path, e.g. "pos.x"
+---@return number[]
+function ecs.field_array(it, term, member)
+end
+
+---Write one numeric member of a term for all rows of the iterator,
+---values[1..it.count] are written directly to the component storage
+---@param it ecs_iter_t
+---@param term integer
+---@param member string @member path, e.g. "pos.x"
+---@param values number[]
+function ecs.set_field_array(it, term, member, values)
+end
+
 ---Obtain the entity id of the signature column
 ---@param it ecs_iter_t
 ---@param column integer
@@ -665,8 +815,15 @@ end
 function ecs.column_entity(it, column)
 end
 
+---Create a filter that can be passed to the functions taking a filter descriptor,
+---it is initialized once instead of on every call
+---@param desc ecs_filter_t|string @descriptor or filter expression
+---@return ecs_compiled_filter_t
+function ecs.filter(desc)
+end
+
 ---Create a filter iterator
----@param filter ecs_filter_t
+---@param filter ecs_filter_t|ecs_compiled_filter_t
 ---@return ecs_iter_t
 function ecs.filter_iter(filter)
 end
@@ -711,7 +868,7 @@ end
 ---Progress the query iterator
 ---@overload fun(it: ecs_iter_t)
 ---@param it ecs_iter_t
----@param filter ecs_filter_t @optional
+---@param filter ecs_filter_t|ecs_compiled_filter_t @optional
 ---@return boolean
 function ecs.query_next(it, filter)
 end
@@ -724,19 +881,36 @@ end
 
 ---Create generic for loop iterator for a query/iterator
 ---Jumping out of the loop will leave the last iteration's
----components unmodified.
+---components unmodified. Single-primitive components are
+---yielded as read-only values, use the iterator columns to write them.
 ---@overload fun(it: ecs_iter_t)
 ---@param query ecs_query_t
 function ecs.each(query)
 end
 
----Create a system
+---Create a system, its entity has an EcsLuaSystemStats component
+---that is updated in the PostFrame phase (custom pipelines must include it).
+---The iterator table is reused across invocations: its fields are rewritten,
+---fields added by the callback are kept
 ---@param callback fun(it: ecs_iter_t)
 ---@param name string
 ---@param phase integer
 ---@param desc ecs_filter_t @optional
+---@param opts ecs_callback_opts_t @optional
+---@return integer @entity
+function ecs.system(callback, name, phase, desc, opts)
+end
+
+---Create a system that is evaluated in C, without calling into Lua.
+---The expression is a list of assignments (=, +=, -=, *=, /=) to numeric
+---members of the system's components, separated by ';'. Operands can be
+---members, numbers, $dt (delta_time) and $time (world_time)
+---@param name string
+---@param phase integer
+---@param signature string @at most 32 terms
+---@param expr string @e.g. "Position.x += Velocity.x * $dt; Position.y += Velocity.y * $dt"
 ---@return integer @entity
-function ecs.system(callback, name, phase, desc)
+function ecs.kernel(name, phase, signature, expr)
 end
 
 ---Create a trigger for a single component
@@ -744,8 +918,9 @@ end
 ---@param name string
 ---@param events integer|integer[]
 ---@param desc string|ecs_term_t @expression or term
+---@param opts ecs_callback_opts_t @optional
 ---@return integer @entity
-function ecs.trigger(callback, name, events, desc)
+function ecs.trigger(callback, name, events, desc, opts)
 end
 
 ---Create an observer
@@ -753,8 +928,9 @@ end
 ---@param name string
 ---@param events integer|integer[]
 ---@param filter ecs_filter_t
+---@param opts ecs_callback_opts_t @optional
 ---@return integer @entity
-function ecs.observer(callback, name, events, filter)
+function ecs.observer(callback, name, events, filter, opts)
 end
 
 ---Run a specific system manually
@@ -787,7 +963,7 @@ end
 
 ---Create a snapshot iterator
 ---@param snapshot ecs_snapshot_t
----@param filter ecs_filter_t
+---@param filter ecs_filter_t|ecs_compiled_filter_t
 ---@return ecs_iter_t
 function ecs.snapshot_iter(snapshot, filter)
 end
@@ -1007,6 +1183,56 @@ end
 function ecs.set_threads(threads)
 end
 
+---Create a Lua state for each worker stage and run the script in it,
+---multi-threaded systems created by the script are bound to the stage's function.
+---Globals are not shared between states and it.param is only set on the main state
+---@param script string @path
+---@return integer @number of stage states
+function ecs.load_stages(script)
+end
+
+---@class ecs_future_t
+local ecs_future_t = {}
+
+---Same as ecs.async_poll(future)
+---@return boolean, table
+function ecs_future_t:poll()
+end
+
+---Same as ecs.async_wait(future)
+---@return boolean, table
+function ecs_future_t:wait()
+end
+
+---Run a function on the async worker pool, the function must not have upvalues
+---and has no access to the world or the globals of the calling state.
+---Arguments and results are converted to and from components (struct types with
+---primitive, enum or bitmask members only)
+---@param func function @receives the argument table (or nil), returns the result table
+---@param arg_type integer @optional
+---@param args table @optional
+---@param result_type integer @optional
+---@return ecs_future_t
+function ecs.async(func, arg_type, args, result_type)
+end
+
+---Check whether the job has finished, raises an error if the job failed
+---@param future ecs_future_t
+---@return boolean, table @true and the result table (or nil) if the job has finished
+function ecs.async_poll(future)
+end
+
+---Block until the job has finished, raises an error if the job failed
+---@param future ecs_future_t
+---@return boolean, table
+function ecs.async_wait(future)
+end
+
+---Set the number of async worker threads (default is 2), queued jobs are finished first
+---@param threads integer
+function ecs.set_async_threads(threads)
+end
+
 ---Get the number of threads
 ---DEPRECATED: use ecs.get_stage_count()
 ---@return integer
@@ -1102,8 +1328,27 @@ local EcsLuaCounter = {}
 ---@field pipeline_build_count_total EcsLuaCounter
 ---@field systems_ran_frame EcsLuaCounter
 ---@field t integer
+---@field lua_rows_written integer @total rows written back after Lua callbacks
+---@field lua_rows_skipped integer @total rows not written back (readonly, proxied or unmodified)
+---@field lua_defer_queued integer @total operations queued by ecs.defer_begin()
+---@field lua_defer_coalesced integer @total queued operations that were merged or cancelled
+---@field lua_defer_flushes integer @total flushes of the queue
+---@field lua_memory_bytes integer @bytes allocated by the Lua states, see ecs.memory_stats()
+---@field lua_memory_peak integer
+---@field lua_memory_count integer @live allocations
 local EcsLuaWorldStats = {}
 
+---@class EcsLuaSystemStats
+---@field invocations integer
+---@field rows integer @total entities passed to the callback
+---@field serialize_ns integer @total time spent pushing the iterator
+---@field call_ns integer @total time spent in the callback
+---@field readback_ns integer @total time spent writing the columns back
+---@field alloc_bytes integer @total net growth of the Lua heap during the callback
+---@field time EcsLuaGauge @milliseconds per invocation, sampled every frame
+---@field t integer
+local EcsLuaSystemStats = {}
+
 ---Get world info
 ---@return ecs_world_info_t
 function ecs.world_info()
@@ -1114,6 +1359,63 @@ end
 function ecs.world_stats()
 end
 
+---Start recording the serialize, call and readback phases of Lua callbacks,
+---frames (also when ecs_progress() is called from C) and ecs_lua_progress() calls. Each stage has a ring
+---of the given capacity (rounded up to a power of 2), older events are overwritten.
+---Fails if tracing is already enabled or when called while the world is progressing
+---@param capacity integer @optional, events per stage (default 16384)
+function ecs.trace_begin(capacity)
+end
+
+---Stop recording, the events are kept until the next ecs.trace_begin()
+---@return integer @number of events in the rings
+function ecs.trace_end()
+end
+
+---Write the recorded events as Chrome trace_event JSON
+---@param path string
+---@return integer|nil @number of events written, nil and an error message on failure
+---@return string|nil
+function ecs.trace_dump(path)
+end
+
+---Start sampling the Lua stack of the main state, samples are folded into
+---"system;source:line;...;source:line" stacks, rooted at the running Lua system or module
+---(or "lua" outside of callbacks). The instruction count between clock checks
+---adapts to the frequency and the speed of the code, time spent in C is not sampled
+---@param hz integer @optional, samples per second (default 1000)
+function ecs.profiler_start(hz)
+end
+
+---Stop sampling and return the stacks in the folded format read by flamegraph.pl
+---@return string @one "stack count" line per stack
+---@return integer @total number of samples
+function ecs.profiler_stop()
+end
+
+---@class ecs_lua_memory_owner_t
+---@field entity integer @Lua system or module, 0 for other code
+---@field bytes integer @live bytes
+---@field count integer @live allocations
+---@field total integer @bytes ever allocated
+local ecs_lua_memory_owner_t = {}
+
+---@class ecs_lua_memory_stats_t
+---@field bytes integer
+---@field peak integer @sum of the peaks of each state
+---@field count integer @live allocations
+---@field total integer @bytes ever allocated
+---@field pool integer @bytes held by the slabs of states created with ECS_LUA_POOL_ALLOC
+---@field owners table<string, ecs_lua_memory_owner_t> @by path, "lua" for code outside of systems and modules
+local ecs_lua_memory_stats_t = {}
+
+---Get the memory used by the Lua state of the world and its worker stage states.
+---Blocks are attributed to the Lua system or module that was running when they
+---were last (re)allocated, only the default allocator keeps counters
+---@return ecs_lua_memory_stats_t
+function ecs.memory_stats()
+end
+
 ---Dimension the world for a specified number of entities
 ---@param count integer entity
 function ecs.dim(count)
@@ -1184,6 +1486,7 @@ ecs.MetaTypeSerializer = dynamic
 ecs.LuaGauge = dynamic
 ecs.LuaCounter = dynamic
 ecs.LuaWorldStats = dynamic
+ecs.LuaSystemStats = dynamic
 ecs.type_op_kind_t = dynamic
 ecs.type_op_t = dynamic
 
@@ -13,6 +13,10 @@ typedef struct EcsLuaHost
 {
     lua_State *L;
     ecs_lua_ctx *ctx;
+
+    /* Worker stage states, [0] is unused (L) */
+    lua_State **states;
+    int32_t state_count;
 }EcsLuaHost;
 
 typedef struct FlecsLua
@@ -29,10 +33,21 @@ void FlecsLuaImport(ecs_world_t *w);
 FLECS_LUA_API
 lua_State *ecs_lua_get_state(ecs_world_t *world);
 
+/* ecs_lua_get_state() flags, only used if the state does not exist yet */
+#define ECS_LUA_POOL_ALLOC (1) /* Small allocations come from size-class slabs of the state */
+
+/* Get the default lua_State, it is created with the given flags */
+FLECS_LUA_API
+lua_State *ecs_lua_get_state_w_flags(ecs_world_t *world, int flags);
+
 /* Reinitialize with a custom lua_State */
 FLECS_LUA_API
 int ecs_lua_set_state(ecs_world_t *w, lua_State *L);
 
+/* Get the lua_State of a stage, NULL if it was not created by ecs.load_stages() */
+FLECS_LUA_API
+lua_State *ecs_lua_get_stage_state(ecs_world_t *world, int32_t stage);
+
 /* Call progress function callback (if set),
    this is meant to be called between iterations. */
 FLECS_LUA_API
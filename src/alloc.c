@@ -0,0 +1,578 @@
+#include "private.h"
+
+/* The default allocator of states created by flecs-lua, each block has a
+   header with the slot of its owner: the Lua system or module that was
+   running when it was last (re)allocated, 0 for everything else.
+
+   With ECS_LUA_POOL_ALLOC blocks of up to ECS_LUA_POOL_MAX bytes come from
+   slabs of the state, one list of slabs with free blocks per size class.
+   A state is only used by one thread at a time, so there is no locking */
+
+#define ECS_LUA_POOL_MAX (512) /* Including the header */
+#define ECS_LUA_POOL_CLASSES (16)
+#define ECS_LUA_SLAB_SIZE (16 * 1024)
+#define ECS_LUA_SLAB_KEEP (2) /* Empty slabs kept per class before they are released */
+
+typedef union ecs_lua_alloc_header
+{
+    struct
+    {
+        int32_t slot;
+        int32_t slab; /* Index + 1, 0 if the block is not pooled */
+    }b;
+
+    lua_Number n; /* Keep the alignment of Lua objects */
+    lua_Integer i;
+    void *p;
+}ecs_lua_alloc_header;
+
+typedef struct ecs_lua_alloc_owner
+{
+    ecs_entity_t entity;
+    int64_t bytes;
+    int64_t count;
+    int64_t total; /* Bytes ever allocated */
+}ecs_lua_alloc_owner;
+
+typedef struct ecs_lua_slab
+{
+    struct ecs_lua_slab *prev; /* Slabs of the class with free blocks */
+    struct ecs_lua_slab *next;
+
+    void *free; /* Freed blocks */
+    int32_t carved; /* Blocks handed out from the untouched tail */
+    int32_t live;
+    int32_t capacity;
+    int32_t block_size;
+    int32_t index;
+    int32_t size_class;
+}ecs_lua_slab;
+
+#define ECS_LUA_SLAB_DATA ((int32_t)((sizeof(ecs_lua_slab) + 15) & ~15))
+
+typedef struct ecs_lua_pool_class
+{
+    ecs_lua_slab *partial;
+    int32_t empty;
+}ecs_lua_pool_class;
+
+struct ecs_lua_alloc
+{
+    const ecs_entity_t *owner; /* &ctx->owner once bound */
+
+    /* Last looked up owner */
+    ecs_entity_t slot_owner;
+    int32_t slot;
+
+    int64_t bytes;
+    int64_t peak;
+    int64_t count;
+    int64_t total;
+
+    int32_t owner_count;
+    int32_t owner_size;
+    ecs_lua_alloc_owner *owners;
+    ecs_map_t *slots; /* entity -> slot */
+
+    bool pool;
+    ecs_lua_pool_class classes[ECS_LUA_POOL_CLASSES];
+
+    int32_t slab_count; /* Allocated */
+    int32_t slab_size;
+    ecs_lua_slab **slabs; /* By index, NULL if released */
+    int32_t slab_free; /* Lowest index that may be NULL */
+};
+
+ecs_lua_alloc *ecs_lua_alloc_new(bool pool)
+{
+    ecs_lua_alloc *a = ecs_os_calloc_t(ecs_lua_alloc);
+
+    a->owner_size = 8;
+    a->owner_count = 1;
+    a->owners = ecs_os_calloc_n(ecs_lua_alloc_owner, a->owner_size);
+    a->slots = ecs_map_new(int32_t, 8);
+
+    a->pool = pool;
+
+    return a;
+}
+
+static void alloc_free(ecs_lua_alloc *a)
+{
+    int32_t i;
+    for(i=0; i < a->slab_size; i++) ecs_os_free(a->slabs[i]);
+
+    ecs_os_free(a->slabs);
+    ecs_map_free(a->slots);
+    ecs_os_free(a->owners);
+    ecs_os_free(a);
+}
+
+/* 16 byte steps up to 128, then 32 up to 256 and 64 up to 512 */
+static int32_t size_class(size_t size)
+{
+    if(size <= 128) return (int32_t)((size + 15) / 16) - 1;
+    if(size <= 256) return 8 + (int32_t)((size - 129) / 32);
+
+    return 12 + (int32_t)((size - 257) / 64);
+}
+
+static int32_t class_size(int32_t c)
+{
+    if(c < 8) return (c + 1) * 16;
+    if(c < 12) return 128 + (c - 7) * 32;
+
+    return 256 + (c - 11) * 64;
+}
+
+static void slab_link(ecs_lua_pool_class *cls, ecs_lua_slab *slab)
+{
+    slab->prev = NULL;
+    slab->next = cls->partial;
+
+    if(cls->partial) cls->partial->prev = slab;
+    cls->partial = slab;
+}
+
+static void slab_unlink(ecs_lua_pool_class *cls, ecs_lua_slab *slab)
+{
+    if(slab->prev) slab->prev->next = slab->next;
+    else cls->partial = slab->next;
+
+    if(slab->next) slab->next->prev = slab->prev;
+}
+
+static ecs_lua_slab *slab_new(ecs_lua_alloc *a, int32_t c)
+{
+    ecs_lua_slab *slab = ecs_os_malloc(ECS_LUA_SLAB_SIZE);
+
+    if(slab == NULL) return NULL;
+
+    while(a->slab_free < a->slab_size && a->slabs[a->slab_free]) a->slab_free++;
+
+    if(a->slab_free == a->slab_size)
+    {
+        int32_t size = a->slab_size ? a->slab_size * 2 : 16;
+        ecs_lua_slab **slabs = ecs_os_realloc(a->slabs, size * (int32_t)sizeof(ecs_lua_slab*));
+
+        if(slabs == NULL)
+        {
+            ecs_os_free(slab);
+            return NULL;
+        }
+
+        memset(&slabs[a->slab_size], 0, (size - a->slab_size) * sizeof(ecs_lua_slab*));
+
+        a->slabs = slabs;
+        a->slab_size = size;
+    }
+
+    memset(slab, 0, sizeof(ecs_lua_slab));
+
+    slab->block_size = class_size(c);
+    slab->capacity = (ECS_LUA_SLAB_SIZE - ECS_LUA_SLAB_DATA) / slab->block_size;
+    slab->size_class = c;
+    slab->index = a->slab_free;
+
+    a->slabs[slab->index] = slab;
+    a->slab_count++;
+
+    /* Empty until the block is taken */
+    a->classes[c].empty++;
+
+    slab_link(&a->classes[c], slab);
+
+    return slab;
+}
+
+static ecs_lua_alloc_header *pool_alloc(ecs_lua_alloc *a, size_t size)
+{
+    int32_t c = size_class(size);
+    ecs_lua_pool_class *cls = &a->classes[c];
+    ecs_lua_slab *slab = cls->partial;
+
+    if(slab == NULL && (slab = slab_new(a, c)) == NULL) return NULL;
+
+    ecs_lua_alloc_header *block;
+
+    if(slab->free)
+    {
+        block = slab->free;
+        slab->free = *(void**)block;
+    }
+    else
+    {
+        block = (ecs_lua_alloc_header*)((char*)slab + ECS_LUA_SLAB_DATA + slab->carved * slab->block_size);
+        slab->carved++;
+    }
+
+    if(!slab->live++) cls->empty--;
+
+    if(slab->live == slab->capacity) slab_unlink(cls, slab);
+
+    block->b.slab = slab->index + 1;
+
+    return block;
+}
+
+static void pool_free(ecs_lua_alloc *a, ecs_lua_alloc_header *block)
+{
+    ecs_lua_slab *slab = a->slabs[block->b.slab - 1];
+    ecs_lua_pool_class *cls = &a->classes[slab->size_class];
+
+    if(slab->live == slab->capacity) slab_link(cls, slab);
+
+    *(void**)block = slab->free;
+    slab->free = block;
+
+    if(--slab->live) return;
+
+    /* Keeping a few empty slabs avoids returning memory
+       to the OS and asking for it again at the boundary */
+    if(cls->empty < ECS_LUA_SLAB_KEEP)
+    {
+        cls->empty++;
+        return;
+    }
+
+    slab_unlink(cls, slab);
+
+    a->slabs[slab->index] = NULL;
+    a->slab_count--;
+
+    if(slab->index < a->slab_free) a->slab_free = slab->index;
+
+    ecs_os_free(slab);
+}
+
+/* Returns a block of at least size bytes with the contents of h */
+static ecs_lua_alloc_header *block_resize(ecs_lua_alloc *a, ecs_lua_alloc_header *h, size_t osize, size_t size)
+{
+    bool pooled = h && h->b.slab;
+    bool pool = a->pool && size <= ECS_LUA_POOL_MAX;
+
+    if(pooled && pool && size_class(osize) == size_class(size)) return h;
+
+    ecs_lua_alloc_header *block;
+
+    if(!pooled && !pool)
+    {
+        block = ecs_os_realloc(h, (ecs_size_t)size);
+        if(block) block->b.slab = 0;
+
+        return block;
+    }
+
+    if(pool) block = pool_alloc(a, size);
+    else
+    {
+        block = ecs_os_malloc((ecs_size_t)size);
+        if(block) block->b.slab = 0;
+    }
+
+    if(block == NULL || h == NULL) return block;
+
+    /* The copy includes the old header */
+    int32_t slab = block->b.slab;
+    memcpy(block, h, osize < size ? osize : size);
+    block->b.slab = slab;
+
+    if(pooled) pool_free(a, h);
+    else ecs_os_free(h);
+
+    return block;
+}
+
+static int32_t owner_slot(ecs_lua_alloc *a)
+{
+    ecs_entity_t e = a->owner ? *a->owner : 0;
+
+    if(e == a->slot_owner) return a->slot;
+
+    int32_t slot = 0;
+
+    if(e)
+    {
+        int32_t *ptr = ecs_map_get(a->slots, int32_t, e);
+
+        if(ptr) slot = *ptr;
+        else
+        {
+            if(a->owner_count == a->owner_size)
+            {
+                a->owner_size *= 2;
+                a->owners = ecs_os_realloc(a->owners, a->owner_size * sizeof(ecs_lua_alloc_owner));
+            }
+
+            slot = a->owner_count++;
+
+            memset(&a->owners[slot], 0, sizeof(ecs_lua_alloc_owner));
+            a->owners[slot].entity = e;
+
+            ecs_map_set(a->slots, e, &slot);
+        }
+    }
+
+    a->slot_owner = e;
+    a->slot = slot;
+
+    return slot;
+}
+
+void *ecs_lua_allocf(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    ecs_lua_alloc *a = ud;
+
+    if(a == NULL)
+    {
+        if(!nsize)
+        {
+            ecs_os_free(ptr);
+            return NULL;
+        }
+
+        return ecs_os_realloc(ptr, nsize);
+    }
+
+    ecs_lua_alloc_header *h = ptr ? (ecs_lua_alloc_header*)ptr - 1 : NULL;
+    ecs_lua_alloc_owner *owner;
+
+    if(h == NULL && !nsize) return NULL;
+
+    /* osize is the type of the object for new blocks */
+    int32_t slot = h ? h->b.slot : 0;
+    size_t header = sizeof(ecs_lua_alloc_header);
+
+    if(!nsize)
+    {
+        if(h->b.slab) pool_free(a, h);
+        else ecs_os_free(h);
+    }
+    else
+    {
+        ecs_lua_alloc_header *block = block_resize(a, h, h ? osize + header : 0, nsize + header);
+
+        if(block == NULL) return NULL;
+
+        h = block;
+    }
+
+    if(ptr)
+    {
+        owner = &a->owners[slot];
+        owner->bytes -= osize;
+        owner->count--;
+
+        a->bytes -= osize;
+        a->count--;
+    }
+
+    if(!nsize) return NULL;
+
+    /* Resized blocks move to the owner that grew them */
+    h->b.slot = owner_slot(a);
+
+    owner = &a->owners[h->b.slot];
+    owner->bytes += nsize;
+    owner->count++;
+    owner->total += nsize;
+
+    a->bytes += nsize;
+    a->count++;
+    a->total += nsize;
+
+    if(a->bytes > a->peak) a->peak = a->bytes;
+
+    return h + 1;
+}
+
+int64_t ecs_lua_alloc_total(const ecs_lua_alloc *a)
+{
+    return a->total;
+}
+
+/* The allocator of a host state may not be thread-safe, worker
+   states always use the built-in one */
+lua_Alloc ecs_lua_get_allocf(lua_State *L, void **ud, bool track)
+{
+    void *parent;
+    lua_Alloc allocf = lua_getallocf(L, &parent);
+
+    ecs_lua_alloc *a = allocf == ecs_lua_allocf ? parent : NULL;
+
+    *ud = track ? ecs_lua_alloc_new(a && a->pool) : NULL;
+
+    return ecs_lua_allocf;
+}
+
+void ecs_lua_alloc_bind(ecs_lua_ctx *ctx)
+{
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(ctx->L, &ud);
+
+    if(allocf != ecs_lua_allocf || ud == NULL) return;
+
+    ctx->alloc = ud;
+    ctx->alloc->owner = &ctx->owner;
+}
+
+void ecs_lua_close(lua_State *L)
+{
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+
+    ecs_lua_alloc *a = allocf == ecs_lua_allocf ? ud : NULL;
+
+    /* The context is freed while closing */
+    if(a) a->owner = NULL;
+
+    lua_close(L);
+
+    if(a) alloc_free(a);
+}
+
+/* Calls func for the main state of the world and its worker stage states */
+static void each_state(lua_State *L, ecs_world_t *w, void (*func)(lua_State*, ecs_lua_ctx*, void*), void *arg)
+{
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    func(ctx->L, ctx, arg);
+
+    int32_t i, count = ecs_get_stage_count(w);
+    for(i=1; i < count && !ctx->stage; i++)
+    {
+        lua_State *S = ecs_lua_get_stage_state(w, i);
+        if(S == NULL) continue;
+
+        func(S, ecs_lua_get_context(S, NULL), arg);
+    }
+}
+
+static void add_totals(lua_State *S, ecs_lua_ctx *ctx, void *arg)
+{
+    ecs_lua_memory_totals *totals = arg;
+    ecs_lua_alloc *a = ctx->alloc;
+
+    if(a == NULL)
+    {/* Foreign allocator */
+        int64_t bytes = (int64_t)lua_gc(S, LUA_GCCOUNT, 0) * 1024 + lua_gc(S, LUA_GCCOUNTB, 0);
+
+        totals->bytes += bytes;
+        totals->peak += bytes;
+        return;
+    }
+
+    totals->bytes += a->bytes;
+    totals->peak += a->peak;
+    totals->count += a->count;
+    totals->total += a->total;
+    totals->pool += (int64_t)a->slab_count * ECS_LUA_SLAB_SIZE;
+}
+
+void ecs_lua_memory_get_totals(lua_State *L, ecs_world_t *w, ecs_lua_memory_totals *totals)
+{
+    memset(totals, 0, sizeof(ecs_lua_memory_totals));
+
+    each_state(L, w, add_totals, totals);
+}
+
+typedef struct owners_arg
+{
+    lua_State *L;
+    ecs_world_t *world;
+}owners_arg;
+
+static void add_owner_field(lua_State *L, const char *field, int64_t value)
+{
+    lua_getfield(L, -1, field);
+    lua_pushinteger(L, lua_tointeger(L, -1) + value);
+    lua_setfield(L, -3, field);
+    lua_pop(L, 1);
+}
+
+/* Merges the owners of a state into the table on top of the stack */
+static void add_owners(lua_State *S, ecs_lua_ctx *ctx, void *arg)
+{
+    owners_arg *o = arg;
+    lua_State *L = o->L;
+    ecs_lua_alloc *a = ctx->alloc;
+
+    if(a == NULL) return;
+
+    int32_t i;
+    for(i=0; i < a->owner_count; i++)
+    {
+        /* Pushing the names may add owners */
+        ecs_lua_alloc_owner owner = a->owners[i];
+
+        if(!owner.total) continue;
+
+        if(!owner.entity) lua_pushliteral(L, "lua");
+        else if(!ecs_is_alive(o->world, owner.entity))
+        {
+            lua_pushfstring(L, "#%I", (lua_Integer)owner.entity);
+        }
+        else
+        {
+            char *path = ecs_get_fullpath(o->world, owner.entity);
+            lua_pushstring(L, path);
+            ecs_os_free(path);
+        }
+
+        lua_pushvalue(L, -1);
+
+        if(lua_rawget(L, -3) == LUA_TNIL)
+        {
+            lua_pop(L, 1);
+
+            lua_createtable(L, 0, 4);
+
+            lua_pushinteger(L, owner.entity);
+            lua_setfield(L, -2, "entity");
+
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            lua_rawset(L, -5);
+        }
+
+        add_owner_field(L, "bytes", owner.bytes);
+        add_owner_field(L, "count", owner.count);
+        add_owner_field(L, "total", owner.total);
+
+        lua_pop(L, 2);
+    }
+}
+
+int memory_stats(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_lua_memory_totals totals;
+    ecs_lua_memory_get_totals(L, w, &totals);
+
+    lua_createtable(L, 0, 6);
+
+    lua_pushinteger(L, totals.bytes);
+    lua_setfield(L, -2, "bytes");
+
+    lua_pushinteger(L, totals.peak);
+    lua_setfield(L, -2, "peak");
+
+    lua_pushinteger(L, totals.count);
+    lua_setfield(L, -2, "count");
+
+    lua_pushinteger(L, totals.total);
+    lua_setfield(L, -2, "total");
+
+    lua_pushinteger(L, totals.pool);
+    lua_setfield(L, -2, "pool");
+
+    lua_newtable(L);
+
+    owners_arg o = { L, w };
+    each_state(L, w, add_owners, &o);
+
+    lua_setfield(L, -2, "owners");
+
+    return 1;
+}
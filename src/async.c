@@ -0,0 +1,533 @@
+#include "private.h"
+
+/* ecs.async() jobs run on a pool of worker states that have no access to the world,
+   arguments and results are passed as component blobs described by a copy of
+   the type's serializer ops */
+
+#define ECS_LUA__ASYNC_THREADS 2
+
+typedef enum ecs_lua_job_status
+{
+    EcsLuaJobPending = 0,
+    EcsLuaJobRunning,
+    EcsLuaJobDone,
+    EcsLuaJobFailed
+}ecs_lua_job_status;
+
+typedef struct ecs_lua_blob
+{
+    ecs_vector_t *ops; /* Copy of the serializer ops */
+    void *ptr;
+    ecs_entity_t type;
+}ecs_lua_blob;
+
+typedef struct ecs_lua_job
+{
+    char *code; /* lua_dump() */
+    size_t code_size;
+
+    ecs_lua_blob arg;
+    ecs_lua_blob result;
+
+    char *error;
+    ecs_lua_job_status status;
+
+    int32_t refs; /* future + pool */
+    struct ecs_lua_job *next;
+}ecs_lua_job;
+
+struct ecs_lua_async
+{
+    ecs_os_mutex_t lock;
+    ecs_os_cond_t work;
+    ecs_os_cond_t done;
+
+    ecs_lua_job *head;
+    ecs_lua_job *tail;
+
+    ecs_os_thread_t *threads;
+    int32_t thread_count;
+    bool quit;
+
+    lua_Alloc allocf;
+    void *ud;
+    char *path;
+    char *cpath;
+};
+
+typedef struct ecs_lua_future
+{
+    ecs_lua_job *job;
+}ecs_lua_future;
+
+static bool blob_op_supported(ecs_type_op_t *op)
+{
+    switch(op->kind)
+    {
+        case EcsOpHeader:
+        case EcsOpPush:
+        case EcsOpPop:
+        case EcsOpPrimitive:
+        case EcsOpEnum:
+        case EcsOpBitmask:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void blob_init(lua_State *L, ecs_world_t *w, ecs_lua_blob *blob, ecs_entity_t type, int arg)
+{
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, w, type);
+    const EcsComponent *ptr = ecs_get(w, type, EcsComponent);
+
+    if(ptr == NULL) luaL_argerror(L, arg, "not a component");
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t i, count = ecs_vector_count(ser->ops);
+
+    if(count < 2 || ops[1].kind != EcsOpPush) luaL_argerror(L, arg, "type must be a struct");
+
+    for(i=0; i < count; i++)
+    {
+        if(!blob_op_supported(&ops[i]))
+            luaL_argerror(L, arg, "type must only have primitive, enum or bitmask members");
+    }
+
+    blob->ops = ecs_vector_copy(ser->ops, ecs_type_op_t);
+    blob->ptr = ecs_os_calloc(ptr->size);
+    blob->type = type;
+}
+
+static void blob_fini(ecs_lua_blob *blob)
+{
+    ecs_type_op_t *ops = ecs_vector_first(blob->ops, ecs_type_op_t);
+    int32_t i, count = ecs_vector_count(blob->ops);
+
+    for(i=0; i < count && blob->ptr; i++)
+    {
+        if(ops[i].kind == EcsOpPrimitive && ops[i].is.primitive == EcsString)
+            ecs_os_free(*(char**)ECS_OFFSET(blob->ptr, ops[i].offset));
+    }
+
+    ecs_vector_free(blob->ops);
+    ecs_os_free(blob->ptr);
+}
+
+/* Pushes the blob as a table, does not touch the world */
+static void blob_push(lua_State *L, ecs_lua_blob *blob)
+{
+    ecs_type_op_t *ops = ecs_vector_first(blob->ops, ecs_type_op_t);
+    int32_t i, count = ecs_vector_count(blob->ops);
+    int depth = 0;
+
+    for(i=1; i < count; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+
+        switch(op->kind)
+        {
+            case EcsOpPush:
+                if(depth++) lua_pushstring(L, op->name);
+                lua_createtable(L, 0, op->count);
+                break;
+            case EcsOpPop:
+                if(--depth) lua_settable(L, -3);
+                break;
+            case EcsOpPrimitive:
+                ecs_lua_push_primitive(L, op->is.primitive, ECS_OFFSET(blob->ptr, op->offset));
+                lua_setfield(L, -2, op->name);
+                break;
+            default: /* Enum, bitmask */
+                lua_pushinteger(L, *(int32_t*)ECS_OFFSET(blob->ptr, op->offset));
+                lua_setfield(L, -2, op->name);
+                break;
+        }
+    }
+}
+
+/* Writes the table at idx to the blob, missing fields are left as they are */
+static void blob_check(lua_State *L, int idx, ecs_lua_blob *blob)
+{
+    ecs_type_op_t *ops = ecs_vector_first(blob->ops, ecs_type_op_t);
+    int32_t i, count = ecs_vector_count(blob->ops);
+    int depth = 0;
+
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    lua_pushvalue(L, idx);
+
+    for(i=1; i < count; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+        void *ptr = ECS_OFFSET(blob->ptr, op->offset);
+
+        switch(op->kind)
+        {
+            case EcsOpPush:
+                if(depth++ && lua_getfield(L, -1, op->name) != LUA_TTABLE)
+                {
+                    lua_pop(L, 1);
+                    lua_newtable(L);
+                }
+                break;
+            case EcsOpPop:
+                lua_pop(L, 1);
+                depth--;
+                break;
+            default:
+                if(lua_getfield(L, -1, op->name) != LUA_TNIL)
+                {
+                    if(op->kind == EcsOpPrimitive) ecs_lua_check_primitive(L, -1, op->is.primitive, ptr);
+                    else *(int32_t*)ptr = (int32_t)luaL_checkinteger(L, -1);
+                }
+                lua_pop(L, 1);
+                break;
+        }
+    }
+}
+
+static void job_release(ecs_lua_job *job)
+{
+    if(ecs_os_adec(&job->refs)) return;
+
+    ecs_os_free(job->code);
+    ecs_os_free(job->error);
+
+    if(job->arg.ops) blob_fini(&job->arg);
+    if(job->result.ops) blob_fini(&job->result);
+
+    ecs_os_free(job);
+}
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+    ecs_lua_job *job = ud;
+
+    job->code = ecs_os_realloc(job->code, job->code_size + sz);
+    ecs_os_memcpy(job->code + job->code_size, p, sz);
+    job->code_size += sz;
+
+    return 0;
+}
+
+/* Runs in the worker state: job */
+static int job_run(lua_State *L)
+{
+    ecs_lua_job *job = lua_touserdata(L, 1);
+
+    if(luaL_loadbufferx(L, job->code, job->code_size, "=async", "b")) return lua_error(L);
+
+    if(job->arg.ops) blob_push(L, &job->arg);
+    else lua_pushnil(L);
+
+    lua_call(L, 1, 1);
+
+    if(job->result.ops && !lua_isnil(L, -1)) blob_check(L, -1, &job->result);
+
+    return 0;
+}
+
+static void *async_thread(void *arg)
+{
+    ecs_lua_async *pool = arg;
+
+    lua_State *L = lua_newstate(pool->allocf, pool->ud);
+
+    luaL_openlibs(L);
+
+    lua_getglobal(L, "package");
+    if(pool->path)
+    {
+        lua_pushstring(L, pool->path);
+        lua_setfield(L, -2, "path");
+    }
+    if(pool->cpath)
+    {
+        lua_pushstring(L, pool->cpath);
+        lua_setfield(L, -2, "cpath");
+    }
+    lua_pop(L, 1);
+
+    ecs_os_mutex_lock(pool->lock);
+
+    while(true)
+    {
+        while(pool->head == NULL && !pool->quit) ecs_os_cond_wait(pool->work, pool->lock);
+
+        ecs_lua_job *job = pool->head;
+
+        if(job == NULL) break; /* quit */
+
+        pool->head = job->next;
+        if(pool->head == NULL) pool->tail = NULL;
+
+        job->status = EcsLuaJobRunning;
+
+        ecs_os_mutex_unlock(pool->lock);
+
+        lua_pushcfunction(L, job_run);
+        lua_pushlightuserdata(L, job);
+
+        int ret = lua_pcall(L, 1, 0, 0);
+
+        if(ret) job->error = ecs_os_strdup(lua_tostring(L, -1));
+
+        lua_settop(L, 0);
+
+        /* Keep the worker's heap from growing across jobs */
+        lua_gc(L, LUA_GCSTEP, 0);
+
+        ecs_os_mutex_lock(pool->lock);
+
+        job->status = ret ? EcsLuaJobFailed : EcsLuaJobDone;
+
+        ecs_os_cond_broadcast(pool->done);
+
+        ecs_os_mutex_unlock(pool->lock);
+
+        job_release(job);
+
+        ecs_os_mutex_lock(pool->lock);
+    }
+
+    ecs_os_mutex_unlock(pool->lock);
+
+    lua_close(L);
+
+    return NULL;
+}
+
+static char *package_string(lua_State *L, const char *field)
+{
+    char *str = NULL;
+
+    if(lua_getglobal(L, "package") == LUA_TTABLE)
+    {
+        if(lua_getfield(L, -1, field) == LUA_TSTRING) str = ecs_os_strdup(lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+
+    return str;
+}
+
+static ecs_lua_async *async_init(lua_State *L, int32_t threads)
+{
+    if(!ecs_os_has_threading()) luaL_error(L, "threading is not available");
+
+    ecs_lua_async *pool = ecs_os_calloc_t(ecs_lua_async);
+
+    pool->lock = ecs_os_mutex_new();
+    pool->work = ecs_os_cond_new();
+    pool->done = ecs_os_cond_new();
+
+    pool->allocf = ecs_lua_get_allocf(L, &pool->ud, false);
+    pool->path = package_string(L, "path");
+    pool->cpath = package_string(L, "cpath");
+
+    pool->threads = ecs_os_calloc_n(ecs_os_thread_t, threads);
+    pool->thread_count = threads;
+
+    int32_t i;
+    for(i=0; i < threads; i++) pool->threads[i] = ecs_os_thread_new(async_thread, pool);
+
+    return pool;
+}
+
+void ecs_lua_async_fini(ecs_lua_ctx *ctx, bool cancel)
+{
+    ecs_lua_async *pool = ctx->async;
+
+    if(pool == NULL) return;
+
+    ecs_os_mutex_lock(pool->lock);
+
+    pool->quit = true;
+
+    while(cancel && pool->head)
+    {
+        ecs_lua_job *job = pool->head;
+
+        pool->head = job->next;
+
+        job->status = EcsLuaJobFailed;
+        job->error = ecs_os_strdup("cancelled");
+
+        job_release(job);
+    }
+
+    if(pool->head == NULL) pool->tail = NULL;
+
+    ecs_os_cond_broadcast(pool->work);
+    ecs_os_cond_broadcast(pool->done);
+
+    ecs_os_mutex_unlock(pool->lock);
+
+    int32_t i;
+    for(i=0; i < pool->thread_count; i++) ecs_os_thread_join(pool->threads[i]);
+
+    ecs_os_cond_free(pool->work);
+    ecs_os_cond_free(pool->done);
+    ecs_os_mutex_free(pool->lock);
+
+    ecs_os_free(pool->threads);
+    ecs_os_free(pool->path);
+    ecs_os_free(pool->cpath);
+    ecs_os_free(pool);
+
+    ctx->async = NULL;
+}
+
+int future_gc(lua_State *L)
+{
+    ecs_lua_future *future = lua_touserdata(L, 1);
+
+    if(future->job) job_release(future->job);
+
+    future->job = NULL;
+
+    return 0;
+}
+
+int async(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
+
+    if(ctx->stage) return luaL_error(L, "ecs.async() is only available in the main state");
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    ecs_entity_t arg_type = luaL_optinteger(L, 2, 0);
+    ecs_entity_t result_type = luaL_optinteger(L, 4, 0);
+
+    if(lua_iscfunction(L, 1)) return luaL_argerror(L, 1, "expected Lua function");
+
+    /* The job is loaded in a state that only has its own globals */
+    const char *upvalue;
+    int i;
+    for(i=1; (upvalue = lua_getupvalue(L, 1, i)); i++)
+    {
+        lua_pop(L, 1);
+        if(strcmp(upvalue, "_ENV")) return luaL_argerror(L, 1, "function must not have upvalues");
+    }
+
+    if(arg_type == 0 && !lua_isnoneornil(L, 3)) return luaL_argerror(L, 2, "argument type expected");
+
+    ecs_lua_future *future = lua_newuserdata(L, sizeof(ecs_lua_future));
+    future->job = NULL;
+    luaL_setmetatable(L, "ecs_future_t");
+
+    ecs_lua_job *job = ecs_os_calloc_t(ecs_lua_job);
+    job->refs = 1;
+    future->job = job;
+
+    /* The future is on top of the stack */
+    lua_pushvalue(L, 1);
+    int dumped = lua_dump(L, dump_writer, job, 0);
+    lua_pop(L, 1);
+
+    if(dumped) return luaL_error(L, "failed to dump function");
+
+    if(arg_type)
+    {
+        blob_init(L, w, &job->arg, arg_type, 2);
+        if(!lua_isnoneornil(L, 3)) blob_check(L, 3, &job->arg);
+    }
+
+    if(result_type) blob_init(L, w, &job->result, result_type, 4);
+
+    if(ctx->async == NULL) ctx->async = async_init(L, ECS_LUA__ASYNC_THREADS);
+
+    ecs_lua_async *pool = ctx->async;
+
+    ecs_os_ainc(&job->refs);
+
+    ecs_os_mutex_lock(pool->lock);
+
+    if(pool->tail) pool->tail->next = job;
+    else pool->head = job;
+
+    pool->tail = job;
+
+    ecs_os_cond_signal(pool->work);
+
+    ecs_os_mutex_unlock(pool->lock);
+
+    return 1;
+}
+
+static int push_result(lua_State *L, ecs_lua_job *job)
+{
+    if(job->status == EcsLuaJobFailed) return luaL_error(L, "async job failed: %s", job->error);
+
+    lua_pushboolean(L, 1);
+
+    if(job->result.ops) blob_push(L, &job->result);
+    else lua_pushnil(L);
+
+    return 2;
+}
+
+static ecs_lua_job_status job_status(ecs_lua_async *pool, ecs_lua_job *job)
+{
+    if(pool == NULL) return job->status;
+
+    ecs_os_mutex_lock(pool->lock);
+    ecs_lua_job_status status = job->status;
+    ecs_os_mutex_unlock(pool->lock);
+
+    return status;
+}
+
+int async_poll(lua_State *L)
+{
+    ecs_lua_future *future = luaL_checkudata(L, 1, "ecs_future_t");
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
+
+    ecs_lua_job_status status = job_status(ctx->async, future->job);
+
+    if(status == EcsLuaJobPending || status == EcsLuaJobRunning)
+    {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+
+    return push_result(L, future->job);
+}
+
+int async_wait(lua_State *L)
+{
+    ecs_lua_future *future = luaL_checkudata(L, 1, "ecs_future_t");
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
+    ecs_lua_async *pool = ctx->async;
+    ecs_lua_job *job = future->job;
+
+    if(pool != NULL)
+    {
+        ecs_os_mutex_lock(pool->lock);
+
+        while(job->status == EcsLuaJobPending || job->status == EcsLuaJobRunning)
+            ecs_os_cond_wait(pool->done, pool->lock);
+
+        ecs_os_mutex_unlock(pool->lock);
+    }
+
+    return push_result(L, job);
+}
+
+int set_async_threads(lua_State *L)
+{
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
+    lua_Integer threads = luaL_checkinteger(L, 1);
+
+    if(threads < 1) return luaL_argerror(L, 1, "at least one thread is required");
+
+    /* Queued jobs are finished by the current threads */
+    ecs_lua_async_fini(ctx, false);
+
+    ctx->async = async_init(L, threads);
+
+    return 0;
+}
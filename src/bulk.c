@@ -1,35 +1,212 @@
 #include "private.h"
 
+#define ECS_LUA__BULK_MAX 32
+
+enum
+{
+    BULK_TABLE,
+    BULK_NONE,
+    BULK_RANGE
+};
+
+static int check_result(lua_State *L, int arg)
+{
+    static const char *const modes[] = { "range", NULL };
+
+    if(lua_type(L, arg) != LUA_TSTRING) return lua_toboolean(L, arg) ? BULK_NONE : BULK_TABLE;
+
+    luaL_checkoption(L, arg, NULL, modes);
+
+    return BULK_RANGE;
+}
+
+static bool copyable(ecs_type_op_t *ops, int32_t count)
+{
+    int32_t i;
+    for(i=0; i < count; i++)
+    {
+        switch(ops[i].kind)
+        {
+            case EcsOpHeader:
+            case EcsOpPush:
+            case EcsOpPop:
+            case EcsOpEnum:
+            case EcsOpBitmask:
+                break;
+            case EcsOpPrimitive:
+                if(ops[i].is.primitive == EcsString) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* Fills a column of count elements from the value at the top of the stack,
+   either an array of per-entity values or a template for all entities */
+static void *fill_column(lua_State *L, ecs_world_t *w, ecs_entity_t component, int32_t count)
+{
+    int value = lua_gettop(L);
+
+    const EcsComponent *c = ecs_get(w, component, EcsComponent);
+
+    if(c == NULL || !c->size) luaL_error(L, "no data for %I, not a component", (lua_Integer)component);
+
+    ecs_size_t size = c->size;
+
+    /* Collected with the stack, even when a value fails to deserialize */
+    void *column = lua_newuserdata(L, (size_t)size * count);
+    memset(column, 0, (size_t)size * count);
+
+    bool use_cursor;
+    const EcsMetaTypeSerializer *ser = ecs_lua_push_plan(L, w, component, &use_cursor);
+    int plan = lua_gettop(L);
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t i, op_count = ecs_vector_count(ser->ops);
+
+    bool parallel = lua_type(L, value) == LUA_TTABLE && (ecs_lua_is_primitive(ser) ||
+        (lua_rawlen(L, value) == (size_t)count && lua_rawgeti(L, value, 1) == LUA_TTABLE));
+    lua_settop(L, plan);
+
+    /* A template without strings or containers is written once and copied */
+    int32_t rows = parallel || use_cursor || !copyable(ops, op_count) ? count : 1;
+
+    for(i=0; i < rows; i++)
+    {
+        void *ptr = ECS_OFFSET(column, size * i);
+
+        if(parallel) lua_rawgeti(L, value, i + 1);
+        else lua_pushvalue(L, value);
+
+        if(use_cursor) ecs_lua_to_ptr(w, L, -1, component, ptr);
+        else ecs_lua_deserialize_op(w, L, -1, ops, op_count, 1, ptr, plan);
+
+        lua_pop(L, 1);
+    }
+
+    for(; i < count; i++) memcpy(ECS_OFFSET(column, size * i), column, size);
+
+    lua_pop(L, 1); /* plan */
+
+    return column; /* at the top of the stack */
+}
+
+static int32_t add_id(lua_State *L, ecs_entity_t *ids, int32_t *n, ecs_entity_t id)
+{
+    int32_t i;
+    for(i=0; i < *n; i++) if(ids[i] == id) return i;
+
+    if(*n == ECS_LUA__BULK_MAX) luaL_error(L, "too many components (max %d)", ECS_LUA__BULK_MAX);
+
+    ids[i] = id;
+    (*n)++;
+
+    return i;
+}
+
+/* Components are created in a single table and their columns are filled
+   from the data table (arg), the type's other components are default-constructed */
+static const ecs_entity_t *new_w_data(lua_State *L, ecs_world_t *w, ecs_type_t type, int32_t count, int arg)
+{
+    ecs_entity_t ids[ECS_LUA__BULK_MAX];
+    void *columns[ECS_LUA__BULK_MAX] = {0};
+    int32_t i, n = 0;
+
+    ecs_entity_t *type_ids = ecs_vector_first(type, ecs_entity_t);
+    int32_t type_count = ecs_vector_count(type);
+
+    for(i=0; i < type_count; i++) add_id(L, ids, &n, type_ids[i]);
+
+    /* Keeps the columns alive until the entities are created */
+    lua_newtable(L);
+    int anchor = lua_gettop(L);
+
+    lua_pushnil(L);
+    while(lua_next(L, arg))
+    {
+        if(!lua_isinteger(L, -2)) luaL_argerror(L, arg, "keys must be components");
+
+        ecs_entity_t component = lua_tointeger(L, -2);
+        int32_t slot = add_id(L, ids, &n, component);
+
+        columns[slot] = fill_column(L, w, component, count);
+
+        lua_rawseti(L, anchor, slot + 1);
+        lua_pop(L, 1);
+    }
+
+    /* The data array must match the (sorted) type of the table */
+    for(i=1; i < n; i++)
+    {
+        ecs_entity_t id = ids[i];
+        void *column = columns[i];
+        int32_t j = i;
+
+        for(; j > 0 && ids[j - 1] > id; j--)
+        {
+            ids[j] = ids[j - 1];
+            columns[j] = columns[j - 1];
+        }
+
+        ids[j] = id;
+        columns[j] = column;
+    }
+
+    ecs_ids_t components = { .array = ids, .count = n };
+
+    return ecs_bulk_new_w_data(w, count, &components, columns);
+}
+
 int bulk_new(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
 
-    int noreturn = 0;
+    int result = BULK_TABLE;
+    int data = 0;
     int args = lua_gettop(L);
     int last_type = lua_type(L, args);
     lua_Integer count = 0;
     ecs_type_t type = NULL;
     const ecs_entity_t *entities = NULL;
 
-    if(args == 2 && last_type == LUA_TBOOLEAN) /* bulk_new(count, noreturn) */
+    if(args == 2 && (last_type == LUA_TBOOLEAN || last_type == LUA_TSTRING)) /* bulk_new(count, noreturn) */
     {
         count = luaL_checkinteger(L, 1);
-        noreturn = lua_toboolean(L, 2);
+        result = check_result(L, 2);
     }
-    else if(args >= 2) /* bulk_new(component, count, [noreturn]) */
+    else if(args >= 2) /* bulk_new(component, count, [data], [noreturn]) */
     {
         ecs_entity_t type_entity = luaL_checkinteger(L, 1);
 
-        type = ecs_type_from_id(w, type_entity);
+        if(type_entity) type = ecs_type_from_id(w, type_entity);
 
         count = luaL_checkinteger(L, 2);
-        noreturn = lua_toboolean(L, 3);
+
+        if(lua_type(L, 3) == LUA_TTABLE) data = 3;
+
+        result = check_result(L, data ? 4 : 3);
     }
     else count = luaL_checkinteger(L, 1); /* bulk_new(count) */
 
-    entities = ecs_bulk_new_w_type(w, type, count);
+    if(count < 0 || count > INT32_MAX) luaL_argerror(L, data ? 2 : 1, "count out of range");
+
+    if(data) entities = new_w_data(L, w, type, count, data);
+    else entities = ecs_bulk_new_w_type(w, type, count);
+
+    if(result == BULK_NONE) return 0;
+
+    if(result == BULK_RANGE)
+    {
+        ecs_lua_range *range = lua_newuserdata(L, sizeof(ecs_lua_range) + sizeof(ecs_entity_t) * count);
+        range->count = count;
+        memcpy(range->entities, entities, sizeof(ecs_entity_t) * count);
+        luaL_setmetatable(L, "ecs_range_t");
 
-    if(noreturn) return 0;
+        return 1;
+    }
 
     lua_createtable(L, count, 0);
 
@@ -43,6 +220,28 @@ int bulk_new(lua_State *L)
     return 1;
 }
 
+int range__index(lua_State *L)
+{
+    ecs_lua_range *range = luaL_checkudata(L, 1, "ecs_range_t");
+
+    int isnum;
+    lua_Integer i = lua_tointegerx(L, 2, &isnum);
+
+    if(isnum && i >= 1 && i <= range->count) lua_pushinteger(L, range->entities[i - 1]);
+    else lua_pushnil(L);
+
+    return 1;
+}
+
+int range__len(lua_State *L)
+{
+    ecs_lua_range *range = luaL_checkudata(L, 1, "ecs_range_t");
+
+    lua_pushinteger(L, range->count);
+
+    return 1;
+}
+
 int bulk_delete(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
@@ -50,9 +249,9 @@ int bulk_delete(lua_State *L)
     if(lua_gettop(L) > 0)
     {
         ecs_filter_t filter;
-        checkfilter(L, w, &filter, 1);
-        ecs_bulk_delete(w, &filter);
-        ecs_filter_fini(&filter);
+        ecs_filter_t *ptr = checkfilter(L, w, &filter, 1);
+        ecs_bulk_delete(w, ptr);
+        if(ptr == &filter) ecs_filter_fini(&filter);
     }
     else ecs_bulk_delete(w, NULL);
 
@@ -0,0 +1,438 @@
+#include "private.h"
+
+/* Column proxies: rows are read and written in place
+   through the type serializer and its field plan, no tables are built */
+
+typedef struct ecs_lua_column_t
+{
+    const ecs_world_t *world;
+    ecs_type_op_t *ops;
+    int32_t op_count;
+    void *ptr; /* NULL once the callback returns */
+    size_t stride;
+    int32_t count;
+    bool readonly;
+}ecs_lua_column_t;
+
+typedef struct ecs_lua_row_t
+{
+    ecs_lua_column_t *col;
+    void *ptr;
+    int32_t scope; /* EcsOpPush */
+}ecs_lua_row_t;
+
+static ecs_lua_column_t *checkcolumn(lua_State *L, int arg)
+{
+    ecs_lua_column_t *col = luaL_checkudata(L, arg, "ecs_column_t");
+
+    if(!col->ptr) luaL_argerror(L, arg, "column is no longer valid");
+
+    return col;
+}
+
+static ecs_lua_row_t *checkrow(lua_State *L, int arg)
+{
+    ecs_lua_row_t *row = luaL_checkudata(L, arg, "ecs_row_t");
+
+    if(!row->col->ptr) luaL_argerror(L, arg, "row is no longer valid");
+
+    return row;
+}
+
+/* The row keeps its column alive through the uservalue */
+static void push_row(lua_State *L, int col_idx, ecs_lua_column_t *col, void *ptr, int32_t scope)
+{
+    col_idx = lua_absindex(L, col_idx);
+
+    ecs_lua_row_t *row = lua_newuserdata(L, sizeof(ecs_lua_row_t));
+
+    row->col = col;
+    row->ptr = ptr;
+    row->scope = scope;
+
+    luaL_setmetatable(L, "ecs_row_t");
+
+    lua_pushvalue(L, col_idx);
+    lua_setuservalue(L, -2);
+}
+
+/* Nested structs are pushed as views, everything else as a copy */
+static void push_member(lua_State *L, int col_idx, ecs_lua_column_t *col, void *ptr, int32_t index)
+{
+    ecs_type_op_t *op = &col->ops[index];
+
+    if(op->kind == EcsOpPush) push_row(L, col_idx, col, ptr, index);
+    else ecs_lua_serialize_op(col->world, L, op, ptr);
+}
+
+static int32_t check_member(lua_State *L, ecs_lua_row_t *row, int plan, int key)
+{
+    int32_t member = ecs_lua_find_member(L, plan, row->scope, key);
+
+    if(member < 0) luaL_error(L, "field \"%s\" does not exist", luaL_tolstring(L, key, NULL));
+
+    return member;
+}
+
+static void *check_element(lua_State *L, ecs_lua_column_t *col, int arg)
+{
+    lua_Integer i = luaL_checkinteger(L, arg);
+
+    if(i < 1 || i > col->count) luaL_argerror(L, arg, "invalid index");
+
+    return ECS_OFFSET(col->ptr, col->stride * (i - 1));
+}
+
+int column__index(lua_State *L)
+{
+    ecs_lua_column_t *col = checkcolumn(L, 1);
+    void *ptr = check_element(L, col, 2);
+
+    push_member(L, 1, col, ptr, 1);
+
+    return 1;
+}
+
+int column__newindex(lua_State *L)
+{
+    ecs_lua_column_t *col = checkcolumn(L, 1);
+    void *ptr = check_element(L, col, 2);
+
+    if(col->readonly) return ecs_lua__readonly(L);
+
+    lua_settop(L, 3);
+    lua_getuservalue(L, 1); /* plan */
+
+    ecs_lua_deserialize_op(col->world, L, 3, col->ops, col->op_count, 1, ptr, 4);
+
+    return 0;
+}
+
+int column__len(lua_State *L)
+{
+    ecs_lua_column_t *col = checkcolumn(L, 1);
+
+    lua_pushinteger(L, col->count);
+
+    return 1;
+}
+
+int row__index(lua_State *L)
+{
+    ecs_lua_row_t *row = checkrow(L, 1);
+
+    lua_settop(L, 2);
+    lua_getuservalue(L, 1); /* column */
+    lua_getuservalue(L, 3); /* plan */
+
+    int32_t member = check_member(L, row, 4, 2);
+
+    push_member(L, 3, row->col, row->ptr, member);
+
+    return 1;
+}
+
+int row__newindex(lua_State *L)
+{
+    ecs_lua_row_t *row = checkrow(L, 1);
+    ecs_lua_column_t *col = row->col;
+
+    lua_settop(L, 3);
+    lua_getuservalue(L, 1); /* column */
+    lua_getuservalue(L, 4); /* plan */
+
+    int32_t member = check_member(L, row, 5, 2);
+
+    if(col->readonly) return ecs_lua__readonly(L);
+
+    ecs_lua_deserialize_op(col->world, L, 3, col->ops, col->op_count, member, row->ptr, 5);
+
+    return 0;
+}
+
+/* Pushes a column userdata with the plan as uservalue */
+static ecs_lua_column_t *push_column(
+    lua_State *L,
+    ecs_iter_t *it,
+    int32_t i,
+    ecs_entity_t type,
+    bool readonly,
+    bool *use_cursor)
+{
+    const EcsMetaTypeSerializer *ser = ecs_lua_push_plan(L, it->world, type, use_cursor);
+
+    ecs_lua_column_t *col = lua_newuserdata(L, sizeof(ecs_lua_column_t));
+
+    col->world = it->world;
+    col->ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    col->op_count = ecs_vector_count(ser->ops);
+    col->ptr = ecs_term_w_size(it, 0, i);
+    col->stride = ecs_term_size(it, i);
+    col->count = it->count;
+    col->readonly = readonly;
+
+    luaL_setmetatable(L, "ecs_column_t");
+
+    lua_insert(L, -2);
+    lua_setuservalue(L, -2); /* plan */
+
+    return col;
+}
+
+void ecs_lua_push_proxy(
+    lua_State *L,
+    ecs_iter_t *it,
+    int32_t i,
+    ecs_entity_t type,
+    bool readonly)
+{
+    ecs_lua_column_t *col = push_column(L, it, i, type, readonly, NULL);
+
+    if(ecs_term_is_owned(it, i)) return;
+
+    /* Shared terms are pushed as a single element */
+    col->stride = 0;
+    col->count = 1;
+
+    push_member(L, -1, col, col->ptr, 1);
+    lua_remove(L, -2);
+}
+
+void ecs_lua_invalidate_proxy(lua_State *L, int idx)
+{
+    ecs_lua_column_t *col = luaL_testudata(L, idx, "ecs_column_t");
+    ecs_lua_row_t *row = luaL_testudata(L, idx, "ecs_row_t");
+
+    if(row) col = row->col;
+
+    if(col == NULL && luaL_getmetafield(L, idx, "__ecs_column") != LUA_TNIL)
+    {/* Tracked column */
+        col = lua_touserdata(L, -1);
+        lua_pop(L, 1);
+    }
+
+    if(col) col->ptr = NULL;
+}
+
+/* Write tracking: it.columns[i] is an empty table, rows are created
+   on first access and only hold the members Lua has assigned (or nested
+   tables it has read). Readback skips rows without such members. */
+
+static const int row_key; /* row[&row_key] = element index */
+
+static void *tracked_element(lua_State *L, ecs_lua_column_t *col, int row)
+{
+    if(!col->ptr) luaL_argerror(L, 1, "row is no longer valid");
+
+    lua_rawgetp(L, row, &row_key);
+    lua_Integer i = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    ecs_assert(i >= 1 && i <= col->count, ECS_INTERNAL_ERROR, NULL);
+
+    return ECS_OFFSET(col->ptr, col->stride * (i - 1));
+}
+
+static int tracked_row__index(lua_State *L)
+{
+    ecs_lua_column_t *col = lua_touserdata(L, lua_upvalueindex(1));
+    void *ptr = tracked_element(L, col, 1);
+
+    lua_settop(L, 2);
+    lua_getuservalue(L, lua_upvalueindex(1)); /* plan */
+
+    int32_t member = ecs_lua_find_member(L, 3, 1, 2);
+
+    if(member < 0) return 0;
+
+    ecs_type_op_t *op = &col->ops[member];
+
+    if(op->kind == EcsOpPush) ecs_lua_serialize_scope(col->world, L, col->ops, member, ptr);
+    else ecs_lua_serialize_op(col->world, L, op, ptr);
+
+    if(lua_type(L, -1) != LUA_TTABLE) return 1;
+
+    /* Nested tables can be modified without our knowledge,
+       they are kept in the row and written back */
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 1);
+
+    return 1;
+}
+
+static int tracked_row_next(lua_State *L)
+{
+    ecs_lua_column_t *col = lua_touserdata(L, lua_upvalueindex(1));
+
+    lua_settop(L, 2);
+    lua_getuservalue(L, lua_upvalueindex(1)); /* plan */
+    lua_rawgeti(L, 3, 1); /* plan[1] (members) */
+
+    lua_Integer n = 1;
+
+    if(!lua_isnil(L, 2))
+    {/* Resume after the previous key */
+        while(lua_rawgeti(L, 4, n++) == LUA_TNUMBER)
+        {
+            const char *name = col->ops[lua_tointeger(L, -1)].name;
+
+            lua_pop(L, 1);
+
+            if(name && lua_type(L, 2) == LUA_TSTRING && !strcmp(name, lua_tostring(L, 2))) break;
+            if(!name && lua_tointeger(L, 2) == n - 1) break;
+        }
+    }
+
+    if(lua_rawgeti(L, 4, n) != LUA_TNUMBER) return 0;
+
+    const char *name = col->ops[lua_tointeger(L, -1)].name;
+
+    if(name) lua_pushstring(L, name);
+    else lua_pushinteger(L, n);
+
+    lua_pushvalue(L, -1);
+    lua_gettable(L, 1);
+
+    return 2;
+}
+
+static int tracked_row__pairs(lua_State *L)
+{
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, tracked_row_next, 1);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+
+    return 3;
+}
+
+static int tracked_column__index(lua_State *L)
+{
+    ecs_lua_column_t *col = checkcolumn(L, lua_upvalueindex(1));
+
+    lua_Integer i = luaL_checkinteger(L, 2);
+
+    if(i < 1 || i > col->count) return 0;
+
+    lua_createtable(L, 0, 1);
+
+    lua_pushinteger(L, i);
+    lua_rawsetp(L, -2, &row_key);
+
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_setmetatable(L, -2);
+
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 1, i);
+
+    return 1;
+}
+
+static int tracked_column__len(lua_State *L)
+{
+    ecs_lua_column_t *col = lua_touserdata(L, lua_upvalueindex(1));
+
+    lua_pushinteger(L, col->count);
+
+    return 1;
+}
+
+bool ecs_lua_push_tracked(lua_State *L, ecs_iter_t *it, int32_t i, ecs_entity_t type)
+{
+    bool use_cursor;
+
+    push_column(L, it, i, type, false, &use_cursor);
+
+    if(use_cursor)
+    {
+        lua_pop(L, 1);
+        return false;
+    }
+
+    int col_idx = lua_gettop(L);
+
+    lua_newtable(L); /* it.columns[i] */
+
+    /* metatable */
+    lua_createtable(L, 0, 3);
+
+    lua_pushvalue(L, col_idx);
+    lua_setfield(L, -2, "__ecs_column");
+
+    lua_pushvalue(L, col_idx);
+
+    /* row metatable */
+    lua_createtable(L, 0, 2);
+
+    lua_pushvalue(L, col_idx);
+    lua_pushcclosure(L, tracked_row__index, 1);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushvalue(L, col_idx);
+    lua_pushcclosure(L, tracked_row__pairs, 1);
+    lua_setfield(L, -2, "__pairs");
+
+    lua_pushcclosure(L, tracked_column__index, 2);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushvalue(L, col_idx);
+    lua_pushcclosure(L, tracked_column__len, 1);
+    lua_setfield(L, -2, "__len");
+
+    lua_setmetatable(L, -2);
+
+    lua_remove(L, col_idx);
+
+    return true;
+}
+
+int32_t ecs_lua_tracked_readback(lua_State *L, int idx)
+{
+    idx = lua_absindex(L, idx);
+
+    if(luaL_getmetafield(L, idx, "__ecs_column") == LUA_TNIL) return -1;
+
+    ecs_lua_column_t *col = lua_touserdata(L, -1);
+    lua_getuservalue(L, -1); /* plan */
+
+    int plan = lua_gettop(L);
+    int32_t written = 0;
+
+    lua_pushnil(L);
+
+    while(lua_next(L, idx))
+    {
+        lua_Integer i = lua_tointeger(L, -2);
+        void *ptr = ECS_OFFSET(col->ptr, col->stride * (i - 1));
+
+        ecs_assert(i >= 1 && i <= col->count, ECS_INTERNAL_ERROR, NULL);
+
+        if(lua_type(L, -1) == LUA_TTABLE)
+        {
+            lua_pushnil(L);
+            lua_rawsetp(L, -2, &row_key);
+
+            lua_pushnil(L);
+
+            if(!lua_next(L, -2))
+            {/* Untouched row */
+                lua_pop(L, 1);
+                continue;
+            }
+
+            lua_pop(L, 2);
+        }
+
+        ecs_lua_deserialize_op(col->world, L, -1, col->ops, col->op_count, 1, ptr, plan);
+        written++;
+
+        lua_pop(L, 1);
+    }
+
+    col->ptr = NULL;
+
+    lua_pop(L, 2); /* plan, column */
+
+    return written;
+}
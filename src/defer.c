@@ -0,0 +1,527 @@
+#include "private.h"
+
+/* Structural changes from Lua are queued while ecs.defer_begin() is active,
+   the outermost ecs.defer_end() coalesces them per entity and applies them.
+
+   Add, remove, delete and the setters (set, set_many, set_fields, setm) are
+   queued, other operations (bulk_new, ...) go to the queue of the world which
+   is applied before this one. Ops are grouped by entity, a delete of an entity
+   referenced by an earlier op of another entity starts a new group so the
+   reference is applied first */
+
+typedef enum ecs_lua_defer_kind
+{
+    DeferDropped = 0,
+    DeferAdd,
+    DeferRemove,
+    DeferSet,
+    DeferDelete
+}ecs_lua_defer_kind;
+
+typedef struct ecs_lua_defer_op
+{
+    ecs_entity_t entity;
+    ecs_id_t id;
+    int32_t kind;
+    int32_t value; /* index in the values table (DeferSet) */
+    int32_t seq;
+}ecs_lua_defer_op;
+
+/* Net state of an id within the ops of an entity */
+typedef struct ecs_lua_defer_slot
+{
+    ecs_id_t id;
+    int32_t kind;
+    bool reset; /* Removed before it was added again */
+}ecs_lua_defer_slot;
+
+/* The values of queued sets are kept in the uservalue */
+struct ecs_lua_defer
+{
+    int32_t depth;
+    int32_t seq;
+    int32_t value_count;
+    ecs_vector_t *ops;
+};
+
+/* State of a flush, collected if it is interrupted by an error.
+   Observers may flush their own batches while it runs */
+typedef struct ecs_lua_flush
+{
+    ecs_vector_t *ops;
+    ecs_vector_t *slots;
+    ecs_vector_t *ids;
+}ecs_lua_flush;
+
+static int defer_gc(lua_State *L)
+{
+    ecs_lua_defer *defer = lua_touserdata(L, 1);
+
+    ecs_vector_free(defer->ops);
+    defer->ops = NULL;
+
+    return 0;
+}
+
+static void flush_fini(ecs_lua_flush *f)
+{
+    ecs_vector_free(f->ops);
+    ecs_vector_free(f->slots);
+    ecs_vector_free(f->ids);
+
+    memset(f, 0, sizeof(ecs_lua_flush));
+}
+
+static int flush_gc(lua_State *L)
+{
+    flush_fini(lua_touserdata(L, 1));
+
+    return 0;
+}
+
+/* Pushes registry[world][ECS_LUA_DEFER], it is created on first use */
+static ecs_lua_defer *push_defer(lua_State *L, ecs_lua_ctx *ctx)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ctx->world);
+
+    if(lua_rawgeti(L, -1, ECS_LUA_DEFER) == LUA_TNIL)
+    {
+        lua_pop(L, 1);
+
+        ecs_lua_defer *defer = lua_newuserdata(L, sizeof(ecs_lua_defer));
+        memset(defer, 0, sizeof(ecs_lua_defer));
+
+        if(luaL_newmetatable(L, "ecs_defer_t"))
+        {
+            lua_pushcfunction(L, defer_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+
+        lua_setmetatable(L, -2);
+
+        lua_newtable(L);
+        lua_setuservalue(L, -2);
+
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, ECS_LUA_DEFER);
+
+        ctx->defer = defer;
+    }
+
+    lua_remove(L, -2);
+
+    return lua_touserdata(L, -1);
+}
+
+ecs_lua_ctx *ecs_lua_deferred(lua_State *L, ecs_world_t *w)
+{
+    /* ecs.defer_begin() also defers the world */
+    if(!ecs_is_deferred(w)) return NULL;
+
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    if(ctx == NULL || ctx->defer == NULL || !ctx->defer->depth) return NULL;
+
+    return ctx;
+}
+
+static void push_op(ecs_lua_ctx *ctx, ecs_lua_defer_kind kind, ecs_entity_t e, ecs_id_t id, int32_t value)
+{
+    ecs_lua_defer *defer = ctx->defer;
+    ecs_lua_defer_op *op = ecs_vector_add(&defer->ops, ecs_lua_defer_op);
+
+    op->entity = e;
+    op->id = id;
+    op->kind = kind;
+    op->value = value;
+    op->seq = defer->seq++;
+
+    ctx->defer_queued++;
+}
+
+void ecs_lua_defer_add(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id)
+{
+    push_op(ctx, DeferAdd, e, id, 0);
+}
+
+void ecs_lua_defer_remove(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id)
+{
+    push_op(ctx, DeferRemove, e, id, 0);
+}
+
+void ecs_lua_defer_type(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_type_t type, bool add)
+{
+    ecs_id_t *ids = ecs_vector_first(type, ecs_id_t);
+    int32_t i, count = ecs_vector_count(type);
+
+    for(i=0; i < count; i++) push_op(ctx, add ? DeferAdd : DeferRemove, e, ids[i], 0);
+}
+
+void ecs_lua_defer_delete(ecs_lua_ctx *ctx, ecs_entity_t e)
+{
+    push_op(ctx, DeferDelete, e, 0, 0);
+}
+
+#define ECS_LUA_DEFER_DEPTH (32)
+
+/* Pushes a copy of the value, tables are copied recursively
+   so later changes by the caller don't affect the queued set */
+static void copy_value(lua_State *L, int idx, int depth)
+{
+    idx = lua_absindex(L, idx);
+
+    if(lua_type(L, idx) != LUA_TTABLE)
+    {
+        lua_pushvalue(L, idx);
+        return;
+    }
+
+    if(depth > ECS_LUA_DEFER_DEPTH) luaL_error(L, "value is too deeply nested");
+
+    lua_createtable(L, (int)lua_rawlen(L, idx), 0);
+
+    lua_pushnil(L);
+
+    while(lua_next(L, idx))
+    {
+        lua_pushvalue(L, -2);
+        copy_value(L, -2, depth + 1);
+        lua_rawset(L, -5);
+        lua_pop(L, 1);
+    }
+}
+
+/* The value is copied when the set is queued and deserialized when the queue is flushed */
+void ecs_lua_defer_set(lua_State *L, ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id, int arg)
+{
+    arg = lua_absindex(L, arg);
+
+    if(!ecs_get_typeid(ctx->world, id)) luaL_argerror(L, arg, "not a component");
+
+    ecs_lua_defer *defer = push_defer(L, ctx);
+    int32_t value = ++defer->value_count;
+
+    lua_getuservalue(L, -1);
+    copy_value(L, arg, 0);
+    lua_rawseti(L, -2, value);
+    lua_pop(L, 2);
+
+    push_op(ctx, DeferSet, e, id, value);
+}
+
+static int compare_op(const void *p1, const void *p2)
+{
+    const ecs_lua_defer_op *op1 = p1;
+    const ecs_lua_defer_op *op2 = p2;
+
+    if(op1->entity != op2->entity) return op1->entity < op2->entity ? -1 : 1;
+
+    return (op1->seq > op2->seq) - (op1->seq < op2->seq);
+}
+
+static int compare_id(const void *p1, const void *p2)
+{
+    ecs_id_t id1 = *(const ecs_id_t*)p1;
+    ecs_id_t id2 = *(const ecs_id_t*)p2;
+
+    return (id1 > id2) - (id1 < id2);
+}
+
+static ecs_lua_defer_slot *get_slot(ecs_lua_flush *f, ecs_id_t id)
+{
+    ecs_lua_defer_slot *slots = ecs_vector_first(f->slots, ecs_lua_defer_slot);
+    int32_t i, count = ecs_vector_count(f->slots);
+
+    for(i=0; i < count; i++) if(slots[i].id == id) return &slots[i];
+
+    ecs_lua_defer_slot *slot = ecs_vector_add(&f->slots, ecs_lua_defer_slot);
+
+    slot->id = id;
+    slot->kind = DeferDropped;
+    slot->reset = false;
+
+    return slot;
+}
+
+/* Adds or removes the ids of the slots with the given state in one table transition */
+static void apply_slots(ecs_world_t *w, ecs_lua_flush *f, ecs_entity_t e, bool add)
+{
+    ecs_lua_defer_slot *slots = ecs_vector_first(f->slots, ecs_lua_defer_slot);
+    int32_t i, count = ecs_vector_count(f->slots);
+
+    ecs_vector_clear(f->ids);
+
+    for(i=0; i < count; i++)
+    {
+        bool added = slots[i].kind == DeferAdd || slots[i].kind == DeferSet;
+        bool removed = slots[i].kind == DeferRemove || slots[i].reset;
+
+        if(add ? !added : !removed) continue;
+
+        *ecs_vector_add(&f->ids, ecs_id_t) = slots[i].id;
+    }
+
+    count = ecs_vector_count(f->ids);
+
+    if(!count) return;
+
+    /* Types are sorted */
+    qsort(ecs_vector_first(f->ids, ecs_id_t), count, sizeof(ecs_id_t), compare_id);
+
+    if(add) ecs_add_type(w, e, (ecs_type_t)f->ids);
+    else ecs_remove_type(w, e, (ecs_type_t)f->ids);
+}
+
+/* Applies the ops of a single entity, expects the values table at the stack top */
+static void flush_entity(lua_State *L, ecs_world_t *w, ecs_lua_ctx *ctx, ecs_lua_flush *f, ecs_lua_defer_op *ops, int32_t count)
+{
+    ecs_entity_t e = ops[0].entity;
+    int32_t i, j, first = 0;
+
+    /* Everything before the last delete is dropped */
+    for(i=count - 1; i >= 0; i--)
+    {
+        if(ops[i].kind == DeferDelete)
+        {
+            ctx->defer_coalesced += i;
+            first = i + 1;
+            ecs_delete(w, e);
+            break;
+        }
+    }
+
+    ecs_vector_clear(f->slots);
+
+    for(i=first; i < count; i++)
+    {
+        ecs_lua_defer_op *op = &ops[i];
+        ecs_lua_defer_slot *slot = get_slot(f, op->id);
+
+        switch(op->kind)
+        {
+            case DeferAdd:
+                if(slot->kind == DeferSet || slot->kind == DeferAdd) ctx->defer_coalesced++; /* already added */
+                else
+                {
+                    /* The component is reset, remove + add is not a no-op */
+                    if(slot->kind == DeferRemove) slot->reset = true;
+                    slot->kind = DeferAdd;
+                }
+                break;
+            case DeferRemove:
+                if(slot->kind == DeferAdd || slot->kind == DeferRemove) ctx->defer_coalesced++;
+
+                /* Values set before the remove are discarded */
+                for(j=first; j < i; j++)
+                {
+                    if(ops[j].kind != DeferSet || ops[j].id != op->id) continue;
+
+                    ops[j].kind = DeferDropped;
+                    ctx->defer_coalesced++;
+                }
+
+                slot->kind = DeferRemove;
+                break;
+            case DeferSet:
+                if(slot->kind == DeferAdd) ctx->defer_coalesced++;
+                if(slot->kind == DeferRemove) slot->reset = true;
+                slot->kind = DeferSet;
+                break;
+            default:
+                break;
+        }
+    }
+
+    apply_slots(w, f, e, false);
+    apply_slots(w, f, e, true);
+
+    int values = lua_gettop(L);
+
+    for(i=first; i < count; i++)
+    {
+        ecs_lua_defer_op *op = &ops[i];
+
+        if(op->kind != DeferSet) continue;
+
+        void *ptr = ecs_get_mut_id(w, e, op->id, NULL);
+
+        lua_rawgeti(L, values, op->value);
+        ecs_lua_to_ptr(w, L, -1, op->id, ptr);
+        lua_pop(L, 1);
+
+        /* Consecutive sets of a component are merged into one OnSet */
+        for(j=i + 1; j < count; j++)
+        {
+            if(ops[j].kind == DeferSet && ops[j].id == op->id) break;
+        }
+
+        if(j == count) ecs_modified_id(w, e, op->id);
+        else ctx->defer_coalesced++;
+    }
+}
+
+static bool references(ecs_id_t id, ecs_entity_t e)
+{
+    uint32_t lo = (uint32_t)e;
+
+    if((uint32_t)id == lo) return true;
+
+    return (id & ECS_ROLE_MASK) == ECS_PAIR && (uint32_t)((id & ~ECS_ROLE_MASK) >> 32) == lo;
+}
+
+/* Returns the end of the group of ops starting at start, ops are in queue order */
+static int32_t group_end(ecs_lua_defer_op *ops, int32_t start, int32_t count)
+{
+    int32_t i, j;
+    for(i=start + 1; i < count; i++)
+    {
+        if(ops[i].kind != DeferDelete) continue;
+
+        for(j=start; j < i; j++)
+        {
+            if(ops[j].entity != ops[i].entity && references(ops[j].id, ops[i].entity)) return i;
+        }
+    }
+
+    return count;
+}
+
+static int32_t flush(lua_State *L, ecs_world_t *w, ecs_lua_ctx *ctx)
+{
+    ecs_lua_flush *f = lua_newuserdata(L, sizeof(ecs_lua_flush));
+    memset(f, 0, sizeof(ecs_lua_flush));
+
+    if(luaL_newmetatable(L, "ecs_flush_t"))
+    {
+        lua_pushcfunction(L, flush_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+
+    lua_setmetatable(L, -2);
+
+    ecs_lua_defer *defer = push_defer(L, ctx);
+
+    /* The queue is emptied first, new operations start a new queue */
+    f->ops = defer->ops;
+    defer->ops = NULL;
+    defer->seq = 0;
+    defer->value_count = 0;
+
+    lua_getuservalue(L, -1);
+    lua_newtable(L);
+    lua_setuservalue(L, -3);
+
+    ecs_lua_defer_op *ops = ecs_vector_first(f->ops, ecs_lua_defer_op);
+    int32_t i, start, first, last, count = ecs_vector_count(f->ops);
+
+    for(start=0; start < count; start = last)
+    {
+        last = group_end(ops, start, count);
+
+        qsort(&ops[start], last - start, sizeof(ecs_lua_defer_op), compare_op);
+
+        for(first=start, i=start + 1; i <= last; i++)
+        {
+            if(i < last && ops[i].entity == ops[first].entity) continue;
+
+            flush_entity(L, w, ctx, f, &ops[first], i - first);
+            first = i;
+        }
+    }
+
+    flush_fini(f);
+    lua_pop(L, 3);
+
+    ctx->defer_flushes++;
+
+    return count;
+}
+
+static void begin(lua_State *L, ecs_world_t *w, ecs_lua_ctx *ctx)
+{
+    ecs_lua_defer *defer = push_defer(L, ctx);
+    lua_pop(L, 1);
+
+    defer->depth++;
+
+    ecs_defer_begin(w);
+}
+
+static int32_t end(lua_State *L, ecs_world_t *w, ecs_lua_ctx *ctx)
+{
+    ecs_lua_defer *defer = push_defer(L, ctx);
+    lua_pop(L, 1);
+
+    if(!defer->depth) luaL_error(L, "not deferred");
+
+    defer->depth--;
+
+    /* Operations deferred by flecs are applied first */
+    ecs_defer_end(w);
+
+    return defer->depth ? 0 : flush(L, w, ctx);
+}
+
+int defer_begin(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    begin(L, w, ecs_lua_get_context(L, ecs_get_world(w)));
+
+    return 0;
+}
+
+int defer_end(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    lua_pushinteger(L, end(L, w, ecs_lua_get_context(L, ecs_get_world(w))));
+
+    return 1;
+}
+
+int is_deferred(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    lua_pushboolean(L, ecs_is_deferred(w));
+
+    return 1;
+}
+
+static int batch_end(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    end(L, w, ecs_lua_get_context(L, ecs_get_world(w)));
+
+    return 0;
+}
+
+/* batch(func, ...) */
+int batch(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    begin(L, w, ctx);
+
+    /* The queue is flushed even if func fails */
+    int ret = lua_pcall(L, lua_gettop(L) - 1, LUA_MULTRET, 0);
+
+    if(!ret)
+    {
+        end(L, w, ctx);
+        return lua_gettop(L);
+    }
+
+    /* The error of func is raised, not the one of the flush */
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, batch_end, 1);
+
+    if(lua_pcall(L, 0, 0, 0)) lua_pop(L, 1);
+
+    return lua_error(L);
+}
@@ -5,6 +5,7 @@ ECS_COMPONENT_DECLARE(EcsLuaWorldInfo);
 ECS_COMPONENT_DECLARE(EcsLuaGauge);
 ECS_COMPONENT_DECLARE(EcsLuaCounter);
 ECS_COMPONENT_DECLARE(EcsLuaWorldStats);
+ECS_COMPONENT_DECLARE(EcsLuaSystemStats);
 ECS_COMPONENT_DECLARE(EcsLuaTermSet);
 ECS_COMPONENT_DECLARE(EcsLuaTermID);
 ECS_COMPONENT_DECLARE(EcsLuaTerm);
@@ -71,8 +72,12 @@ bool ecs_lua_progress(lua_State *L, lua_Number delta_time)
 
     lua_pushnumber(L, delta_time);
 
+    int64_t start = ecs_lua_time_ns();
+
     int ret = lua_pcall(L, 1, 1, 0);
 
+    if(ctx->trace) ecs_lua_trace_record(ctx->trace, 0, EcsLuaTraceProgress, 0, start, ecs_lua_time_ns() - start);
+
     if(ret)
     {
         const char *err = lua_tostring(L, lua_gettop(L));
@@ -233,6 +238,16 @@ int get_func(lua_State *L);
 int get_mut(lua_State *L);
 int patch_func(lua_State *L);
 int set_func(lua_State *L);
+int set_many(lua_State *L);
+int defer_begin(lua_State *L);
+int defer_end(lua_State *L);
+int is_deferred(lua_State *L);
+int batch(lua_State *L);
+int get_fields(lua_State *L);
+int set_fields(lua_State *L);
+int new_member(lua_State *L);
+int getm(lua_State *L);
+int setm(lua_State *L);
 
 int new_ref(lua_State *L);
 int get_ref(lua_State *L);
@@ -253,6 +268,8 @@ int set_name_prefix(lua_State *L);
 
 /* Bulk */
 int bulk_new(lua_State *L);
+int range__index(lua_State *L);
+int range__len(lua_State *L);
 int bulk_delete(lua_State *L);
 
 /* Iterator */
@@ -260,6 +277,12 @@ int iter_term(lua_State *L);
 int iter_terms(lua_State *L);
 int is_owned(lua_State *L);
 int term_id(lua_State *L);
+int field_array(lua_State *L);
+int set_field_array(lua_State *L);
+int iter_getm(lua_State *L);
+int iter_setm(lua_State *L);
+int filter_new(lua_State *L);
+int filter_gc(lua_State *L);
 int filter_iter(lua_State *L);
 int filter_next(lua_State *L);
 int term_iter(lua_State *L);
@@ -274,6 +297,13 @@ int query_next(lua_State *L);
 int query_changed(lua_State *L);
 int each_func(lua_State *L);
 
+/* Column */
+int column__index(lua_State *L);
+int column__newindex(lua_State *L);
+int column__len(lua_State *L);
+int row__index(lua_State *L);
+int row__newindex(lua_State *L);
+
 /* Snapshot */
 int snapshot_take(lua_State *L);
 int snapshot_restore(lua_State *L);
@@ -283,10 +313,12 @@ int snapshot_gc(lua_State *L);
 
 /* System */
 int new_system(lua_State *L);
+int new_kernel(lua_State *L);
 int new_trigger(lua_State *L);
 int new_observer(lua_State *L);
 int run_system(lua_State *L);
 int set_system_context(lua_State *L);
+int callback_gc(lua_State *L);
 
 /* Module */
 int new_module(lua_State *L);
@@ -336,15 +368,34 @@ int reset_clock(lua_State *L);
 int lquit(lua_State *L);
 int deactivate_systems(lua_State *L);
 int set_threads(lua_State *L);
+int load_stages(lua_State *L);
+int set_async_threads(lua_State *L);
 int get_threads(lua_State *L);
 int get_thread_index(lua_State *L);
 
+/* Async */
+int async(lua_State *L);
+int async_poll(lua_State *L);
+int async_wait(lua_State *L);
+int future_gc(lua_State *L);
+
 /* World */
 int world_new(lua_State *L);
 int world_fini(lua_State *L);
 int world_gc(lua_State *L);
 int world_info(lua_State *L);
 int world_stats(lua_State *L);
+
+/* Tracing */
+int trace_begin(lua_State *L);
+int trace_end(lua_State *L);
+int trace_dump(lua_State *L);
+
+/* Profiling */
+int profiler_start(lua_State *L);
+int profiler_stop(lua_State *L);
+
+int memory_stats(lua_State *L);
 int dim(lua_State *L);
 int dim_type(lua_State *L);
 
@@ -423,6 +474,16 @@ static const luaL_Reg ecs_lib[] =
     { "get_mut", get_mut },
     { "patch", patch_func },
     { "set", set_func },
+    { "set_many", set_many },
+    { "defer_begin", defer_begin },
+    { "defer_end", defer_end },
+    { "is_deferred", is_deferred },
+    { "batch", batch },
+    { "get_fields", get_fields },
+    { "set_fields", set_fields },
+    { "member", new_member },
+    { "getm", getm },
+    { "setm", setm },
     { "ref", new_ref },
     { "get_ref", get_ref },
 
@@ -447,8 +508,11 @@ static const luaL_Reg ecs_lib[] =
     { "column", iter_term }, // compat
     { "columns", iter_terms }, // compat
     { "is_owned", is_owned },
+    { "field_array", field_array },
+    { "set_field_array", set_field_array },
     { "column_entity", term_id }, // compat
     { "term_id", term_id },
+    { "filter", filter_new },
     { "filter_iter", filter_iter },
     { "filter_next", filter_next },
     { "term_iter", term_iter },
@@ -462,6 +526,7 @@ static const luaL_Reg ecs_lib[] =
     { "each", each_func },
 
     { "system", new_system },
+    { "kernel", new_kernel },
     { "trigger", new_trigger },
     { "observer", new_observer },
     { "run", run_system },
@@ -513,6 +578,12 @@ static const luaL_Reg ecs_lib[] =
     { "quit", lquit },
     { "deactivate_systems", deactivate_systems },
     { "set_threads", set_threads },
+    { "load_stages", load_stages },
+
+    { "async", async },
+    { "async_poll", async_poll },
+    { "async_wait", async_wait },
+    { "set_async_threads", set_async_threads },
     { "get_threads", get_threads },
     { "get_thread_index", get_thread_index },
 
@@ -523,6 +594,12 @@ static const luaL_Reg ecs_lib[] =
     { "fini", world_fini },
     { "world_info", world_info },
     { "world_stats", world_stats },
+    { "trace_begin", trace_begin },
+    { "trace_end", trace_end },
+    { "trace_dump", trace_dump },
+    { "profiler_start", profiler_start },
+    { "profiler_stop", profiler_stop },
+    { "memory_stats", memory_stats },
     { "dim", dim },
     { "dim_type", dim_type },
 
@@ -567,11 +644,72 @@ static void register_types(lua_State *L)
     lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, "ecs_compiled_filter_t");
+    lua_pushcfunction(L, filter_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
     luaL_newmetatable(L, "ecs_snapshot_t");
     lua_pushcfunction(L, snapshot_gc);
     lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);
 
+    /* Methods of iterator tables */
+    luaL_newmetatable(L, "ecs_iter_t");
+    lua_pushcfunction(L, field_array);
+    lua_setfield(L, -2, "field_array");
+    lua_pushcfunction(L, set_field_array);
+    lua_setfield(L, -2, "set_field_array");
+    lua_pushcfunction(L, iter_getm);
+    lua_setfield(L, -2, "getm");
+    lua_pushcfunction(L, iter_setm);
+    lua_setfield(L, -2, "setm");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_member_t");
+    lua_pushboolean(L, false);
+    lua_setfield(L, -2, "__metatable");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_future_t");
+    lua_pushcfunction(L, future_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_createtable(L, 0, 2);
+    lua_pushcfunction(L, async_poll);
+    lua_setfield(L, -2, "poll");
+    lua_pushcfunction(L, async_wait);
+    lua_setfield(L, -2, "wait");
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_range_t");
+    lua_pushcfunction(L, range__index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, range__len);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_callback_t");
+    lua_pushcfunction(L, callback_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_column_t");
+    lua_pushcfunction(L, column__index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, column__newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushcfunction(L, column__len);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "ecs_row_t");
+    lua_pushcfunction(L, row__index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, row__newindex);
+    lua_setfield(L, -2, "__newindex");
+    lua_pop(L, 1);
+
     luaL_newmetatable(L, "ecs_time_t");
     lua_pushcfunction(L, time__tostring);
     lua_setfield(L, -2, "__tostring");
@@ -627,7 +765,22 @@ int luaopen_ecs(lua_State *L)
     lua_rawsetp(L, LUA_REGISTRYINDEX, w);
 
         if(default_world) lua_rawgetp(L, LUA_REGISTRYINDEX, ECS_LUA_DEFAULT_CTX);
-        else lua_pushvalue(L, 1);
+        else
+        {/* ecs.init() worlds share the state, but not the context */
+            ecs_lua_ctx *ctx = lua_newuserdata(L, sizeof(ecs_lua_ctx));
+
+            *ctx = (ecs_lua_ctx)
+            {
+                .L = L,
+                .world = w,
+                .internal = ECS_LUA__KEEPOPEN,
+                .progress_ref = LUA_NOREF,
+                .prefix_ref = LUA_NOREF
+            };
+        }
+
+        ecs_lua_ctx *ctx = lua_touserdata(L, -1);
+        if(!ctx->stage) ecs_lua_track_names(w, ctx);
 
         lua_rawseti(L, -2, ECS_LUA_CONTEXT);
 
@@ -637,6 +790,10 @@ int luaopen_ecs(lua_State *L)
         lua_createtable(L, 128, 0);
         lua_rawseti(L, -2, ECS_LUA_TYPES);
 
+        /* world[exprs] = { [expr] = ecs_lua_type_expr } */
+        lua_createtable(L, 0, 16);
+        lua_rawseti(L, -2, ECS_LUA_EXPRS);
+
         /* world[collect] = { [object1], [object2], ... } */
         lua_createtable(L, 0, 16);
         luaL_setmetatable(L, "ecs_collect_t");
@@ -695,6 +852,8 @@ static ecs_lua_ctx *ctx_init(ecs_lua_ctx ctx)
     lctx->progress_ref = LUA_NOREF;
     lctx->prefix_ref = LUA_NOREF;
 
+    ecs_lua_alloc_bind(lctx);
+
     if( !(ctx.flags & ECS_LUA__DYNAMIC))
     {
         luaL_requiref(L, "ecs", luaopen_ecs, 1);
@@ -712,27 +871,28 @@ static void ecs_lua_exit(lua_State *L)
 
     ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
 
-    if( !(ctx->internal & ECS_LUA__KEEPOPEN) ) lua_close(L);
-}
+    /* The host may close a state it owns at any time */
+    ecs_lua_untrack_names(ctx);
 
-static void *Allocf(void *ud, void *ptr, size_t osize, size_t nsize)
-{
-    if(!nsize)
-    {
-        ecs_os_free(ptr);
-        return NULL;
-    }
+    /* Workers would stay blocked on the pool of the replaced state */
+    ecs_lua_async_fini(ctx, true);
 
-    return ecs_os_realloc(ptr, nsize);
+    if( !(ctx->internal & ECS_LUA__KEEPOPEN) ) ecs_lua_close(L);
 }
 
 lua_State *ecs_lua_get_state(ecs_world_t *world)
+{
+    return ecs_lua_get_state_w_flags(world, 0);
+}
+
+lua_State *ecs_lua_get_state_w_flags(ecs_world_t *world, int flags)
 {
     const EcsLuaHost *host = ecs_singleton_get(world, EcsLuaHost);
 
     if(!host)
     {
-        lua_State *L = lua_newstate(Allocf, NULL);
+        ecs_lua_alloc *alloc = ecs_lua_alloc_new(flags & ECS_LUA_POOL_ALLOC);
+        lua_State *L = lua_newstate(ecs_lua_allocf, alloc);
 
         ecs_lua_ctx param = { L, world };
 
@@ -767,28 +927,149 @@ int ecs_lua_set_state(ecs_world_t *world, lua_State *L)
     return 0;
 }
 
+lua_State *ecs_lua_get_stage_state(ecs_world_t *world, int32_t stage)
+{
+    const EcsLuaHost *host = ecs_singleton_get(world, EcsLuaHost);
+
+    if(!host) return NULL;
+    if(!stage) return host->L;
+    if(stage < 0 || stage >= host->state_count) return NULL;
+
+    return host->states[stage];
+}
+
+static void copy_package_path(lua_State *from, lua_State *to, const char *field)
+{
+    lua_getglobal(from, "package");
+    lua_getglobal(to, "package");
+
+    if(lua_istable(from, -2) && lua_istable(to, -1))
+    {
+        lua_getfield(from, -2, field);
+        lua_pushstring(to, lua_tostring(from, -1));
+        lua_setfield(to, -2, field);
+        lua_pop(from, 1);
+    }
+
+    lua_pop(from, 1);
+    lua_pop(to, 1);
+}
+
+static lua_State *stage_state(lua_State *L, ecs_world_t *world, EcsLuaHost *host, int32_t stage)
+{
+    if(stage >= host->state_count)
+    {
+        host->states = ecs_os_realloc(host->states, (stage + 1) * sizeof(lua_State*));
+        memset(&host->states[host->state_count], 0, (stage + 1 - host->state_count) * sizeof(lua_State*));
+        host->state_count = stage + 1;
+    }
+
+    lua_State *S = host->states[stage];
+
+    if(S) return S;
+
+    void *ud;
+    lua_Alloc allocf = ecs_lua_get_allocf(L, &ud, true);
+
+    S = lua_newstate(allocf, ud);
+
+    luaL_openlibs(S);
+
+    copy_package_path(L, S, "path");
+    copy_package_path(L, S, "cpath");
+
+    ecs_lua_ctx param = { .L = S, .world = world, .internal = ECS_LUA__KEEPOPEN, .stage = stage };
+
+    ctx_init(param);
+
+    host->states[stage] = S;
+
+    return S;
+}
+
+/* Worker stages get their own state, the script is run once in
+   each of them to bind the functions of multi-threaded systems */
+int load_stages(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    const char *script = luaL_checkstring(L, 1);
+
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, NULL);
+
+    if(ctx->stage) return luaL_error(L, "stages can only be loaded from the main state");
+
+    EcsLuaHost *host = ecs_singleton_get_mut(w, EcsLuaHost);
+
+    int32_t i, count = ecs_get_stage_count(w);
+
+    for(i=1; i < count; i++)
+    {
+        lua_State *S = stage_state(L, w, host, i);
+
+        if(luaL_dofile(S, script))
+        {
+            lua_pushfstring(L, "stage %d: %s", i, lua_tostring(S, -1));
+            lua_pop(S, 1);
+
+            ecs_singleton_modified(w, EcsLuaHost);
+
+            return lua_error(L);
+        }
+    }
+
+    ecs_singleton_modified(w, EcsLuaHost);
+
+    lua_pushinteger(L, count > 1 ? count - 1 : 0);
+
+    return 1;
+}
+
 ECS_CTOR(EcsLuaHost, ptr,
 {
     memset(ptr, 0, sizeof(EcsLuaHost));
 });
 
+ECS_CTOR(EcsLuaSystemStats, ptr,
+{
+    memset(ptr, 0, sizeof(EcsLuaSystemStats));
+});
+
 static void ecs_lua_atfini(ecs_world_t *world, void *ctx)
 {
     EcsLuaHost *ptr = ecs_singleton_get_mut(world, EcsLuaHost);
 
     ecs_assert(ptr != NULL, ECS_INTERNAL_ERROR, NULL);
 
+    /* Worker stage states hold no callbacks of their own */
+    int32_t i;
+    for(i=1; i < ptr->state_count; i++)
+    {
+        if(ptr->states[i]) ecs_lua_close(ptr->states[i]);
+    }
+
+    ecs_os_free(ptr->states);
+    ptr->states = NULL;
+    ptr->state_count = 0;
+
     lua_State *L = ptr->L;
-    if(L == NULL) return;
+    if(L == NULL)
+    {
+        ecs_singleton_modified(world, EcsLuaHost);
+        return;
+    }
 
     ecs_world_t *wdefault = ecs_lua_get_world(L);
 
     if(wdefault == world)
     {/* This is the default world in this VM */
+        ecs_lua_async_fini(ecs_lua_get_context(L, NULL), true);
+
+        ecs_lua_untrack_names(ecs_lua_get_context(L, NULL));
+
         lua_rawgetp(L, LUA_REGISTRYINDEX, ECS_LUA_DEFAULT_WORLD);
         luaL_callmeta(L, -1, "__gc");
 
-        lua_close(L);
+        ecs_lua_close(L);
         ptr->L = NULL;
     }
 
@@ -818,6 +1099,7 @@ void FlecsLuaImport(ecs_world_t *w)
     ECS_META_DEFINE(w, EcsLuaGauge);
     ECS_META_DEFINE(w, EcsLuaCounter);
     ECS_META_DEFINE(w, EcsLuaWorldStats);
+    ECS_META_DEFINE(w, EcsLuaSystemStats);
     ECS_META_DEFINE(w, EcsLuaTermSet);
     ECS_META_DEFINE(w, EcsLuaTermID);
     ECS_META_DEFINE(w, EcsLuaTerm);
@@ -829,5 +1111,29 @@ void FlecsLuaImport(ecs_world_t *w)
         .ctor = ecs_ctor(EcsLuaHost),
     });
 
+    ecs_set_component_actions(w, EcsLuaSystemStats,
+    {
+        .ctor = ecs_ctor(EcsLuaSystemStats),
+    });
+
+    ecs_system_init(w, &(ecs_system_desc_t)
+    {
+        .entity = { .name = "SystemStatsCollect", .add = EcsPostFrame },
+        .query.filter.terms = {{ ecs_id(EcsLuaSystemStats) }},
+        .callback = ecs_lua__system_stats
+    });
+
+    ecs_system_init(w, &(ecs_system_desc_t)
+    {
+        .entity = { .name = "TraceFrameBegin", .add = EcsPreFrame },
+        .callback = ecs_lua__trace_frame_begin
+    });
+
+    ecs_system_init(w, &(ecs_system_desc_t)
+    {
+        .entity = { .name = "TraceFrameEnd", .add = EcsPostFrame },
+        .callback = ecs_lua__trace_frame_end
+    });
+
     ecs_atfini(w, ecs_lua_atfini, NULL);
 }
@@ -88,7 +88,7 @@ int new_entity(lua_State *L)
     ecs_entity_t scope = ecs_get_scope(w);
     if(scope) ecs_add_pair(w, e, EcsChildOf, scope);
 
-    if(components) ecs_add_type(w, e, ecs_type_from_str(w, components));
+    if(components) ecs_add_type(w, e, ecs_lua_type_from_str(L, w, args));
 
     if(name) ecs_set_name(w, e, name);
 
@@ -111,13 +111,16 @@ int new_id(lua_State *L)
 int delete_entity(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
 
     ecs_entity_t entity;
 
     if(lua_isinteger(L, 1))
     {
         entity = luaL_checkinteger(L, 1);
-        ecs_delete(w, entity);
+
+        if(deferred) ecs_lua_defer_delete(deferred, entity);
+        else ecs_delete(w, entity);
     }
     else if(lua_type(L, 1) == LUA_TTABLE)
     {
@@ -127,7 +130,10 @@ int delete_entity(lua_State *L)
         {
             lua_rawgeti(L, 1, i + 1);
             entity = luaL_checkinteger(L, -1);
-            ecs_delete(w, entity);
+
+            if(deferred) ecs_lua_defer_delete(deferred, entity);
+            else ecs_delete(w, entity);
+
             lua_pop(L, 1);
         }
 
@@ -425,6 +431,7 @@ int exists(lua_State *L)
 int entity_add(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
 
     int args = lua_gettop(L);
 
@@ -434,19 +441,25 @@ int entity_add(lua_State *L)
     {
         ecs_entity_t relation = luaL_checkinteger(L, 2);
         ecs_entity_t object = luaL_checkinteger(L, 3);
-        ecs_add_pair(w, e, relation, object);
+
+        if(deferred) ecs_lua_defer_add(deferred, e, ecs_pair(relation, object));
+        else ecs_add_pair(w, e, relation, object);
     }
     else /* add(e, integer|ecs_type_t) */
     {
         if(lua_isinteger(L, 2))
         {
             ecs_entity_t to_add = luaL_checkinteger(L, 2);
-            ecs_add_id(w, e, to_add);
+
+            if(deferred) ecs_lua_defer_add(deferred, e, to_add);
+            else ecs_add_id(w, e, to_add);
         }
         else
         {
             ecs_type_t type = checktype(L, 2);
-            ecs_add_type(w, e, type);
+
+            if(deferred) ecs_lua_defer_type(deferred, e, type, true);
+            else ecs_add_type(w, e, type);
         }
     }
 
@@ -456,6 +469,7 @@ int entity_add(lua_State *L)
 int entity_remove(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
 
     int args = lua_gettop(L);
     ecs_entity_t e = luaL_checkinteger(L, 1);
@@ -464,19 +478,25 @@ int entity_remove(lua_State *L)
     {
         ecs_entity_t relation = luaL_checkinteger(L, 2);
         ecs_entity_t object = luaL_checkinteger(L, 3);
-        ecs_remove_pair(w, e, relation, object);
+
+        if(deferred) ecs_lua_defer_remove(deferred, e, ecs_pair(relation, object));
+        else ecs_remove_pair(w, e, relation, object);
     }
     else
     {
         if(lua_isinteger(L, 2))
         {
             ecs_entity_t to_remove = luaL_checkinteger(L, 2);
-            ecs_remove_id(w, e, to_remove);
+
+            if(deferred) ecs_lua_defer_remove(deferred, e, to_remove);
+            else ecs_remove_id(w, e, to_remove);
         }
         else
         {
             ecs_type_t type = checktype(L, 2);
-            ecs_remove_type(w, e, type);
+
+            if(deferred) ecs_lua_defer_type(deferred, e, type, false);
+            else ecs_remove_type(w, e, type);
         }
     }
 
@@ -538,7 +558,7 @@ int entity_count(lua_State *L)
         ecs_entity_t e = luaL_checkinteger(L, 1);
         count = ecs_count_id(w, e);
     }
-    else if(type == LUA_TUSERDATA)
+    else if(type == LUA_TUSERDATA && luaL_testudata(L, 1, "ecs_type_t"))
     {
         ecs_type_t type = checktype(L, 1);
         count = ecs_count_filter(w, &(ecs_filter_t){ .include = type });
@@ -546,9 +566,9 @@ int entity_count(lua_State *L)
     else
     {
         ecs_filter_t filter;
-        checkfilter(L, w, &filter, 1);
-        count = ecs_count_filter(w, &filter);
-        ecs_filter_fini(&filter);
+        ecs_filter_t *ptr = checkfilter(L, w, &filter, 1);
+        count = ecs_count_filter(w, ptr);
+        if(ptr == &filter) ecs_filter_fini(&filter);
     }
 
     lua_pushinteger(L, count);
@@ -574,7 +594,22 @@ int new_type(lua_State *L)
     const char *name = luaL_checkstring(L, 1);
     const char *expr = luaL_checkstring(L, 2);
 
-    ecs_entity_t e = ecs_type_init(w, &(ecs_type_desc_t){ .ids_expr = expr });
+    ecs_type_desc_t desc = { .ids_expr = expr };
+
+    /* Use the cached ids if they fit */
+    ecs_type_t type = ecs_lua_type_from_str(L, w, 2);
+    int32_t i, count = ecs_vector_count(type);
+
+    if(type && count <= (int32_t)(sizeof(desc.ids) / sizeof(desc.ids[0])))
+    {
+        ecs_id_t *ids = ecs_vector_first(type, ecs_id_t);
+
+        for(i=0; i < count; i++) desc.ids[i] = ids[i];
+
+        desc.ids_expr = NULL;
+    }
+
+    ecs_entity_t e = ecs_type_init(w, &desc);
 
     ecs_set_name(w, e, name);
 
@@ -593,11 +628,7 @@ int get_type(lua_State *L)
 
     int arg_type = lua_type(L, 1);
 
-    if(arg_type == LUA_TSTRING)
-    {
-        const char *expr = luaL_checkstring(L, 1);
-        type = ecs_type_from_str(w, expr);
-    }
+    if(arg_type == LUA_TSTRING) type = ecs_lua_type_from_str(L, w, 1);
     else
     {
         e = luaL_checkinteger(L, 1);
@@ -694,7 +725,10 @@ int add_pair(lua_State *L)
     ecs_entity_t c = luaL_checkinteger(L, 2);
     ecs_entity_t t = luaL_checkinteger(L, 3);
 
-    ecs_add_id(w, e, ecs_pair(c, t));
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
+    if(deferred) ecs_lua_defer_add(deferred, e, ecs_pair(c, t));
+    else ecs_add_id(w, e, ecs_pair(c, t));
 
     return 0;
 }
@@ -707,7 +741,10 @@ int remove_pair(lua_State *L)
     ecs_entity_t c = luaL_checkinteger(L, 2);
     ecs_entity_t t = luaL_checkinteger(L, 3);
 
-    ecs_remove_id(w, e, ecs_pair(c, t));
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
+    if(deferred) ecs_lua_defer_remove(deferred, e, ecs_pair(c, t));
+    else ecs_remove_id(w, e, ecs_pair(c, t));
 
     return 0;
 }
@@ -1236,16 +1273,186 @@ int set_func(lua_State *L)
     ecs_entity_t e = luaL_checkinteger(L, 1);
     ecs_entity_t component = luaL_checkinteger(L, 2);
 
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
     if(!e)
     {
         e = ecs_new_id(w);
         ecs_entity_t scope = ecs_get_scope(w);
-        if(scope) ecs_add_pair(w, e, EcsChildOf, scope);
+
+        if(scope && deferred) ecs_lua_defer_add(deferred, e, ecs_pair(EcsChildOf, scope));
+        else if(scope) ecs_add_pair(w, e, EcsChildOf, scope);
+    }
+
+    if(deferred) ecs_lua_defer_set(L, deferred, e, component, 3);
+    else
+    {
+        void *ptr = ecs_get_mut_id(w, e, component, NULL);
+
+        ecs_lua_to_ptr(w, L, 3, component, ptr);
+
+        ecs_modified_id(w, e, component);
+    }
+
+    lua_pushinteger(L, e);
+
+    return 1;
+}
+
+/* Returns the serializer ops of a struct whose members can be flattened
+   into primitive values (nested structs are expanded in place) */
+static ecs_type_op_t *field_ops(lua_State *L, ecs_world_t *w, ecs_entity_t component, int32_t *count)
+{
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, w, component);
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t i, n = ecs_vector_count(ser->ops);
+
+    if(n < 2 || ops[1].kind != EcsOpPush) luaL_argerror(L, 2, "not a struct");
+
+    for(i=2; i < n; i++)
+    {
+        switch(ops[i].kind)
+        {
+            case EcsOpPush:
+            case EcsOpPop:
+            case EcsOpPrimitive:
+            case EcsOpEnum:
+            case EcsOpBitmask:
+                break;
+            default:
+                luaL_argerror(L, 2, "struct has collection members");
+        }
+    }
+
+    *count = n;
+
+    return ops;
+}
+
+int get_fields(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_entity_t e = luaL_checkinteger(L, 1);
+    ecs_entity_t component = luaL_checkinteger(L, 2);
+
+    int32_t i, count;
+    ecs_type_op_t *ops = field_ops(L, w, component, &count);
+
+    const void *ptr = ecs_get_id(w, e, component);
+
+    if(ptr == NULL)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    luaL_checkstack(L, count, NULL);
+
+    int n = 0;
+
+    for(i=2; i < count; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+        const void *base = ECS_OFFSET(ptr, op->offset);
+
+        if(op->kind == EcsOpPrimitive) ecs_lua_push_primitive(L, op->is.primitive, base);
+        else if(op->kind == EcsOpEnum || op->kind == EcsOpBitmask) lua_pushinteger(L, *(int32_t*)base);
+        else continue;
+
+        n++;
+    }
+
+    return n;
+}
+
+int set_fields(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_entity_t e = luaL_checkinteger(L, 1);
+    ecs_entity_t component = luaL_checkinteger(L, 2);
+
+    int32_t i, count;
+    ecs_type_op_t *ops = field_ops(L, w, component, &count);
+
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
+    if(!e)
+    {
+        e = ecs_new_id(w);
+        ecs_entity_t scope = ecs_get_scope(w);
+
+        if(scope && deferred) ecs_lua_defer_add(deferred, e, ecs_pair(EcsChildOf, scope));
+        else if(scope) ecs_add_pair(w, e, EcsChildOf, scope);
+    }
+
+    /* Values are consumed in declaration order, nil leaves the member unchanged */
+    int arg = 3, top = lua_gettop(L);
+
+    if(deferred)
+    {/* Queued as a set of a table with the given members */
+        int depth = 0;
+
+        lua_newtable(L);
+
+        for(i=2; i < count && arg <= top; i++)
+        {
+            ecs_type_op_t *op = &ops[i];
+
+            if(op->kind == EcsOpPush)
+            {
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, op->name);
+                depth++;
+                continue;
+            }
+
+            if(op->kind == EcsOpPop)
+            {
+                if(!depth) continue;
+
+                lua_pop(L, 1);
+                depth--;
+                continue;
+            }
+
+            if(!lua_isnil(L, arg))
+            {
+                lua_pushvalue(L, arg);
+                lua_setfield(L, -2, op->name);
+            }
+
+            arg++;
+        }
+
+        lua_settop(L, top + 1);
+
+        ecs_lua_defer_set(L, deferred, e, component, top + 1);
+
+        lua_pushinteger(L, e);
+
+        return 1;
     }
 
     void *ptr = ecs_get_mut_id(w, e, component, NULL);
 
-    ecs_lua_to_ptr(w, L, 3, component, ptr);
+    for(i=2; i < count && arg <= top; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+        void *base = ECS_OFFSET(ptr, op->offset);
+
+        if(op->kind == EcsOpPush || op->kind == EcsOpPop) continue;
+
+        if(!lua_isnil(L, arg))
+        {
+            if(op->kind == EcsOpPrimitive) ecs_lua_check_primitive(L, arg, op->is.primitive, base);
+            else *(int32_t*)base = (int32_t)luaL_checkinteger(L, arg);
+        }
+
+        arg++;
+    }
 
     ecs_modified_id(w, e, component);
 
@@ -1254,6 +1461,177 @@ int set_func(lua_State *L)
     return 1;
 }
 
+int new_member(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_entity_t component = luaL_checkinteger(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, w, component);
+    ecs_type_op_t *op = ecs_lua_member_op(ecs_vector_first(ser->ops, ecs_type_op_t), ecs_vector_count(ser->ops), path);
+
+    if(op == NULL) return luaL_argerror(L, 2, "member does not exist");
+
+    if(op->kind != EcsOpPrimitive && op->kind != EcsOpEnum && op->kind != EcsOpBitmask)
+        return luaL_argerror(L, 2, "member is not a primitive");
+
+    ecs_lua_member *m = lua_newuserdata(L, sizeof(ecs_lua_member));
+    luaL_setmetatable(L, "ecs_member_t");
+
+    m->component = component;
+    m->offset = op->offset;
+    m->kind = op->kind;
+    m->primitive = op->is.primitive;
+
+    lua_pushvalue(L, 2);
+    lua_setuservalue(L, -2);
+
+    return 1;
+}
+
+void ecs_lua_push_member(lua_State *L, const ecs_lua_member *m, const void *base)
+{
+    base = ECS_OFFSET(base, m->offset);
+
+    if(m->kind == EcsOpPrimitive) ecs_lua_push_primitive(L, m->primitive, base);
+    else lua_pushinteger(L, *(int32_t*)base);
+}
+
+void ecs_lua_check_member(lua_State *L, int arg, const ecs_lua_member *m, void *base)
+{
+    base = ECS_OFFSET(base, m->offset);
+
+    if(m->kind == EcsOpPrimitive) ecs_lua_check_primitive(L, arg, m->primitive, base);
+    else *(int32_t*)base = (int32_t)luaL_checkinteger(L, arg);
+}
+
+int getm(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_entity_t e = luaL_checkinteger(L, 1);
+    ecs_lua_member *m = luaL_checkudata(L, 2, "ecs_member_t");
+
+    const void *ptr = ecs_get_id(w, e, m->component);
+
+    if(ptr) ecs_lua_push_member(L, m, ptr);
+    else lua_pushnil(L);
+
+    return 1;
+}
+
+int setm(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_entity_t e = luaL_checkinteger(L, 1);
+    ecs_lua_member *m = luaL_checkudata(L, 2, "ecs_member_t");
+    luaL_checkany(L, 3);
+
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
+    if(deferred)
+    {/* Queued as a set of { path = value } */
+        lua_settop(L, 3);
+        lua_getuservalue(L, 2);
+
+        const char *path = lua_tostring(L, 4), *dot;
+
+        lua_newtable(L);
+
+        for(dot = strchr(path, '.'); dot; path = dot + 1, dot = strchr(path, '.'))
+        {
+            lua_newtable(L);
+            lua_pushlstring(L, path, dot - path);
+            lua_pushvalue(L, -2);
+            lua_settable(L, -4);
+        }
+
+        lua_pushvalue(L, 3);
+        lua_setfield(L, -2, path);
+
+        ecs_lua_defer_set(L, deferred, e, m->component, 5);
+
+        return 0;
+    }
+
+    void *ptr = ecs_get_mut_id(w, e, m->component, NULL);
+
+    ecs_lua_check_member(L, 3, m, ptr);
+
+    ecs_modified_id(w, e, m->component);
+
+    return 0;
+}
+
+int set_many(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_lua_range *range = luaL_testudata(L, 1, "ecs_range_t");
+    if(!range) luaL_checktype(L, 1, LUA_TTABLE);
+    ecs_entity_t component = luaL_checkinteger(L, 2);
+    luaL_checkany(L, 3);
+
+    lua_Integer i, count = range ? range->count : (lua_Integer)lua_rawlen(L, 1);
+
+    /* Resolved once for all entities */
+    bool use_cursor;
+    const EcsMetaTypeSerializer *ser = ecs_lua_push_plan(L, w, component, &use_cursor);
+    int plan = lua_gettop(L);
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t op_count = ecs_vector_count(ser->ops);
+
+    /* values[i] for entities[i], or one value for all entities */
+    bool parallel = count && lua_type(L, 3) == LUA_TTABLE && (ecs_lua_is_primitive(ser) ||
+        ((lua_Integer)lua_rawlen(L, 3) == count && lua_rawgeti(L, 3, 1) == LUA_TTABLE));
+    lua_settop(L, plan);
+
+    ecs_lua_ctx *deferred = ecs_lua_deferred(L, w);
+
+    for(i=1; i <= count; i++)
+    {
+        ecs_entity_t e;
+
+        if(range) e = range->entities[i - 1];
+        else
+        {
+            lua_rawgeti(L, 1, i);
+
+            int isnum;
+            e = lua_tointegerx(L, -1, &isnum);
+            lua_pop(L, 1);
+
+            if(!isnum || !e) return luaL_argerror(L, 1, "invalid entity");
+        }
+
+        if(parallel) lua_rawgeti(L, 3, i);
+        else lua_pushvalue(L, 3);
+
+        if(deferred)
+        {
+            ecs_lua_defer_set(L, deferred, e, component, -1);
+            lua_pop(L, 1);
+            continue;
+        }
+
+        void *ptr = ecs_get_mut_id(w, e, component, NULL);
+
+        if(use_cursor) ecs_lua_to_ptr(w, L, -1, component, ptr);
+        else ecs_lua_deserialize_op(w, L, -1, ops, op_count, 1, ptr, plan);
+
+        ecs_modified_id(w, e, component);
+
+        lua_pop(L, 1);
+    }
+
+    lua_pushinteger(L, count);
+
+    return 1;
+}
+
 int new_ref(lua_State *L)
 {
     ecs_entity_t e = luaL_checkinteger(L, 1);
@@ -21,17 +21,20 @@ int scope_iter(lua_State *L)
 
     ecs_iter_t it;
 
+    ecs_filter_t filter, *ptr = NULL;
+
     if(lua_gettop(L) > 1)
     {
-        ecs_filter_t filter;
-        checkfilter(L, w, &filter, 2);
-        it = ecs_scope_iter_w_filter(w, parent, &filter);
-        ecs_filter_fini(&filter);
+        ptr = checkfilter(L, w, &filter, 2);
+        it = ecs_scope_iter_w_filter(w, parent, ptr);
+        if(ptr == &filter) ecs_filter_fini(&filter);
     }
     else it = ecs_scope_iter(w, parent);
 
     ecs_iter_to_lua(&it, L, true);
 
+    if(ptr && ptr != &filter) ecs_lua_iter_anchor(L, 2);
+
     return 1;
 }
 
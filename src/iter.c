@@ -1,6 +1,16 @@
 #include "private.h"
 
 
+void ecs_lua_iter_anchor(lua_State *L, int arg)
+{
+    arg = lua_absindex(L, arg);
+
+    lua_getmetatable(L, -1);
+    lua_pushvalue(L, arg);
+    lua_setfield(L, -2, "__ecs_filter");
+    lua_pop(L, 1);
+}
+
 ecs_iter_t *ecs_lua__checkiter(lua_State *L, int arg)
 {
     if(luaL_getmetafield(L, arg, "__ecs_iter") == LUA_TNIL)
@@ -130,19 +140,268 @@ int term_id(lua_State *L)
     return 1;
 }
 
+/* Resolves it, term, "member.path" at arg 1-3 to the member's
+   column pointer and stride (0 for shared terms) */
+static ecs_type_op_t *check_field(lua_State *L, ecs_iter_t **it_out, char **base, ecs_size_t *stride)
+{
+    ecs_iter_t *it = ecs_lua__checkiter(L, 1);
+    lua_Integer term = luaL_checkinteger(L, 2);
+    const char *path = luaL_checkstring(L, 3);
+
+    if(term < 1 || term > it->column_count) luaL_argerror(L, 2, "invalid term index");
+
+    ecs_entity_t type = ecs_get_typeid(it->world, ecs_term_id(it, term));
+
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, it->world, type);
+    ecs_type_op_t *op = ecs_lua_member_op(ecs_vector_first(ser->ops, ecs_type_op_t), ecs_vector_count(ser->ops), path);
+
+    if(op == NULL || op->kind != EcsOpPrimitive || op->is.primitive == EcsString)
+        luaL_argerror(L, 3, "not a numeric member");
+
+    void *ptr = ecs_term_w_size(it, 0, term);
+
+    if(ptr == NULL) luaL_argerror(L, 2, "term is not set");
+
+    *it_out = it;
+    *base = ECS_OFFSET(ptr, op->offset);
+    *stride = ecs_term_is_owned(it, term) ? (ecs_size_t)ecs_term_size(it, term) : 0;
+
+    return op;
+}
+
+#define ECS_LUA__FIELD_KINDS(XX) \
+    XX(EcsF32, float, lua_pushnumber) \
+    XX(EcsF64, double, lua_pushnumber) \
+    XX(EcsI32, int32_t, lua_pushinteger) \
+    XX(EcsU32, uint32_t, lua_pushinteger) \
+    XX(EcsI64, int64_t, lua_pushinteger)
+
+int field_array(lua_State *L)
+{
+    ecs_iter_t *it;
+    char *base;
+    ecs_size_t stride;
+
+    ecs_type_op_t *op = check_field(L, &it, &base, &stride);
+
+    int32_t i, count = it->count;
+
+    lua_createtable(L, count, 0);
+
+    switch(op->is.primitive)
+    {
+#define XX(kind, T, push) \
+        case kind: \
+            for(i=0; i < count; i++) \
+            { \
+                push(L, *(T*)(base + i * stride)); \
+                lua_rawseti(L, -2, i + 1); \
+            } \
+            break;
+        ECS_LUA__FIELD_KINDS(XX)
+#undef XX
+        default:
+            for(i=0; i < count; i++)
+            {
+                ecs_lua_push_primitive(L, op->is.primitive, base + i * stride);
+                lua_rawseti(L, -2, i + 1);
+            }
+            break;
+    }
+
+    return 1;
+}
+
+/* Keeps serialized rows in sync, otherwise the callback readback
+   would write the old values back */
+void ecs_lua_sync_row(lua_State *L, int idx, int32_t row, const char *path)
+{
+    idx = lua_absindex(L, idx);
+
+    lua_geti(L, -1, row);
+
+    ecs_lua_sync_member(L, idx, path);
+}
+
+void ecs_lua_sync_member(lua_State *L, int idx, const char *path)
+{
+    idx = lua_absindex(L, idx);
+
+    const char *key = path, *dot;
+
+    for(dot = strchr(key, '.'); dot && lua_type(L, -1) == LUA_TTABLE; key = dot + 1, dot = strchr(key, '.'))
+    {
+        lua_pushlstring(L, key, dot - key);
+        lua_gettable(L, -2);
+        lua_remove(L, -2);
+    }
+
+    if(lua_type(L, -1) == LUA_TTABLE)
+    {
+        lua_pushvalue(L, idx);
+        lua_setfield(L, -2, key);
+    }
+
+    lua_pop(L, 1);
+}
+
+int set_field_array(lua_State *L)
+{
+    ecs_iter_t *it;
+    char *base;
+    ecs_size_t stride;
+
+    ecs_type_op_t *op = check_field(L, &it, &base, &stride);
+    lua_Integer term = lua_tointeger(L, 2);
+    int32_t i, count = it->count;
+
+    luaL_checktype(L, 4, LUA_TTABLE);
+
+    if(!stride) return luaL_argerror(L, 2, "term is not owned");
+    if(ecs_lua_term_readonly(L, 1, it, term)) return luaL_argerror(L, 2, "term is readonly");
+    if(lua_rawlen(L, 4) < (size_t)count) return luaL_argerror(L, 4, "array is shorter than it.count");
+
+    switch(op->is.primitive)
+    {
+        case EcsF32:
+            for(i=0; i < count; i++)
+            {
+                lua_rawgeti(L, 4, i + 1);
+                *(float*)(base + i * stride) = (float)luaL_checknumber(L, -1);
+                lua_pop(L, 1);
+            }
+            break;
+        case EcsF64:
+            for(i=0; i < count; i++)
+            {
+                lua_rawgeti(L, 4, i + 1);
+                *(double*)(base + i * stride) = luaL_checknumber(L, -1);
+                lua_pop(L, 1);
+            }
+            break;
+        default:
+            for(i=0; i < count; i++)
+            {
+                lua_rawgeti(L, 4, i + 1);
+                ecs_lua_check_primitive(L, -1, op->is.primitive, base + i * stride);
+                lua_pop(L, 1);
+            }
+            break;
+    }
+
+    luaL_getsubtable(L, 1, "columns");
+
+    if(lua_rawgeti(L, -1, term) == LUA_TTABLE)
+    {
+        const char *path = lua_tostring(L, 3);
+
+        for(i=1; i <= count; i++)
+        {
+            lua_rawgeti(L, 4, i);
+            lua_insert(L, -2);
+            ecs_lua_sync_row(L, -2, i, path);
+            lua_remove(L, -2);
+        }
+    }
+
+    return 0;
+}
+
+/* Returns the term of the iterator that has the handle's component */
+static int32_t member_term(lua_State *L, ecs_iter_t *it, ecs_lua_member *m)
+{
+    int32_t i;
+    for(i=1; i <= it->column_count; i++)
+    {
+        if(ecs_get_typeid(it->world, ecs_term_id(it, i)) == m->component) return i;
+    }
+
+    return luaL_argerror(L, 2, "component is not a term of the iterator");
+}
+
+/* The row argument defaults to the current row of ecs.each() */
+static lua_Integer check_row(lua_State *L, ecs_iter_t *it, int32_t term)
+{
+    if(!lua_isnoneornil(L, 3)) return luaL_checkinteger(L, 3);
+
+    lua_Integer row = ecs_lua_each_row(L, 1, it, term);
+
+    if(!row) return luaL_argerror(L, 3, "row expected outside of ecs.each()");
+
+    lua_pop(L, 1);
+
+    return row;
+}
+
+static void *member_row(lua_State *L, ecs_iter_t *it, int32_t term, lua_Integer row)
+{
+    if(row < 1 || row > it->count) luaL_argerror(L, 3, "invalid row");
+
+    void *base = ecs_term_w_size(it, 0, term);
+
+    if(base == NULL) luaL_argerror(L, 2, "term is not set");
+
+    if(!ecs_term_is_owned(it, term)) return base;
+
+    return ECS_OFFSET(base, (row - 1) * ecs_term_size(it, term));
+}
+
+int iter_getm(lua_State *L)
+{
+    ecs_iter_t *it = ecs_lua__checkiter(L, 1);
+    ecs_lua_member *m = luaL_checkudata(L, 2, "ecs_member_t");
+
+    int32_t term = member_term(L, it, m);
+    lua_Integer row = check_row(L, it, term);
+
+    ecs_lua_push_member(L, m, member_row(L, it, term, row));
+
+    return 1;
+}
+
+int iter_setm(lua_State *L)
+{
+    ecs_iter_t *it = ecs_lua__checkiter(L, 1);
+    ecs_lua_member *m = luaL_checkudata(L, 2, "ecs_member_t");
+    luaL_checkany(L, 4);
+
+    int32_t term = member_term(L, it, m);
+
+    if(!ecs_term_is_owned(it, term)) return luaL_argerror(L, 2, "term is not owned");
+    if(ecs_lua_term_readonly(L, 1, it, term)) return luaL_argerror(L, 2, "term is readonly");
+
+    lua_Integer row = check_row(L, it, term);
+
+    ecs_lua_check_member(L, 4, m, member_row(L, it, term, row));
+
+    lua_getuservalue(L, 2);
+    const char *path = lua_tostring(L, -1);
+
+    /* The row table of ecs.each() is read back when the loop advances */
+    if(ecs_lua_each_row(L, 1, it, term) == row) ecs_lua_sync_member(L, 4, path);
+
+    luaL_getsubtable(L, 1, "columns");
+
+    if(lua_rawgeti(L, -1, term) == LUA_TTABLE) ecs_lua_sync_row(L, 4, row, path);
+
+    return 0;
+}
+
 int filter_iter(lua_State *L)
 {
     ecs_world_t *w = ecs_lua_world(L);
 
     ecs_filter_t filter;
-    checkfilter(L, w, &filter, 1);
+    ecs_filter_t *ptr = checkfilter(L, w, &filter, 1);
 
-    ecs_iter_t it = ecs_filter_iter(w, &filter);
+    ecs_iter_t it = ecs_filter_iter(w, ptr);
 
-    ecs_filter_fini(&filter);
+    if(ptr == &filter) ecs_filter_fini(&filter);
 
     ecs_iter_to_lua(&it, L, true);
 
+    if(ptr != &filter) ecs_lua_iter_anchor(L, 1);
+
     return 1;
 }
 
@@ -0,0 +1,562 @@
+#include "private.h"
+
+#include <ctype.h> /* isspace(), isdigit() */
+
+/* Kernels are systems whose body is a list of assignments over component members,
+   compiled to a register bytecode and evaluated in C over blocks of rows:
+
+   "Position.x += Velocity.x * $dt; Position.y += Velocity.y * $dt"
+*/
+
+#define ECS_LUA__KERNEL_BLOCK 64
+#define ECS_LUA__KERNEL_REGS 16
+#define ECS_LUA__KERNEL_OPS 256
+#define ECS_LUA__KERNEL_TERMS 32
+#define ECS_LUA__KERNEL_MAGIC 0x6b726e6c /* "krnl", tells kernels from other native systems */
+
+typedef enum ecs_lua_kernel_opcode
+{
+    EcsKernelLoad,
+    EcsKernelStore,
+    EcsKernelConst,
+    EcsKernelDeltaTime,
+    EcsKernelWorldTime,
+    EcsKernelAdd,
+    EcsKernelSub,
+    EcsKernelMul,
+    EcsKernelDiv,
+    EcsKernelNeg
+}ecs_lua_kernel_opcode;
+
+typedef struct ecs_lua_kernel_op
+{
+    ecs_lua_kernel_opcode code;
+    int16_t dst, a, b;
+
+    /* Load, store */
+    int32_t term; /* 0-based */
+    int32_t offset;
+    ecs_primitive_kind_t kind;
+
+    double value; /* Const */
+}ecs_lua_kernel_op;
+
+typedef struct ecs_lua_kernel
+{
+    uint32_t magic;
+
+    ecs_lua_kernel_op ops[ECS_LUA__KERNEL_OPS];
+    int32_t op_count;
+
+    int32_t term_count;
+    ecs_size_t sizes[ECS_LUA__KERNEL_TERMS];
+    ecs_entity_t ids[ECS_LUA__KERNEL_TERMS];
+    bool readonly[ECS_LUA__KERNEL_TERMS];
+    uint64_t used; /* Terms referenced by the expression */
+    uint64_t written;
+}ecs_lua_kernel;
+
+typedef struct kernel_parser
+{
+    lua_State *L;
+    ecs_world_t *world;
+    ecs_lua_kernel *k;
+    const char *expr;
+    const char *ptr;
+}kernel_parser;
+
+static int parse_error(kernel_parser *p, const char *msg)
+{
+    return luaL_error(p->L, "kernel: %s at column %d in \"%s\"", msg, (int)(p->ptr - p->expr) + 1, p->expr);
+}
+
+static void skip_ws(kernel_parser *p)
+{
+    while(isspace((unsigned char)*p->ptr)) p->ptr++;
+}
+
+static bool accept(kernel_parser *p, char c)
+{
+    skip_ws(p);
+
+    if(*p->ptr != c) return false;
+
+    p->ptr++;
+
+    return true;
+}
+
+static bool is_ident(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+static ecs_lua_kernel_op *emit(kernel_parser *p, ecs_lua_kernel_opcode code, int dst)
+{
+    ecs_lua_kernel *k = p->k;
+
+    if(k->op_count == ECS_LUA__KERNEL_OPS) parse_error(p, "expression too long");
+    if(dst >= ECS_LUA__KERNEL_REGS) parse_error(p, "expression too complex");
+
+    ecs_lua_kernel_op *op = &k->ops[k->op_count++];
+
+    memset(op, 0, sizeof(ecs_lua_kernel_op));
+
+    op->code = code;
+    op->dst = dst;
+
+    return op;
+}
+
+static bool is_numeric(ecs_primitive_kind_t kind)
+{
+    switch(kind)
+    {
+        case EcsByte:
+        case EcsU8:
+        case EcsU16:
+        case EcsU32:
+        case EcsU64:
+        case EcsI8:
+        case EcsI16:
+        case EcsI32:
+        case EcsI64:
+        case EcsF32:
+        case EcsF64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* "Component.member[.member]" */
+static ecs_lua_kernel_op *parse_member(kernel_parser *p, ecs_lua_kernel_opcode code, int dst)
+{
+    ecs_lua_kernel *k = p->k;
+    char name[256];
+
+    skip_ws(p);
+
+    const char *start = p->ptr;
+
+    while(is_ident(*p->ptr)) p->ptr++;
+
+    size_t len = p->ptr - start;
+
+    if(!len) parse_error(p, "expected member");
+    if(len >= sizeof(name)) parse_error(p, "name too long");
+
+    memcpy(name, start, len);
+    name[len] = '\0';
+
+    /* The component name can be a path, try every prefix */
+    char *dot;
+    for(dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.'))
+    {
+        *dot = '\0';
+
+        ecs_entity_t e = ecs_lookup_fullpath(p->world, name);
+
+        *dot = '.';
+
+        int32_t i;
+        for(i=0; e && i < k->term_count; i++)
+        {
+            if(k->ids[i] != e) continue;
+
+            const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(p->L, p->world, e);
+
+            ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+            ecs_type_op_t *m = ecs_lua_member_op(ops, ecs_vector_count(ser->ops), dot + 1);
+
+            if(m == NULL || m->kind != EcsOpPrimitive) parse_error(p, "member does not exist");
+            if(!is_numeric(m->is.primitive)) parse_error(p, "member is not numeric");
+
+            ecs_lua_kernel_op *op = emit(p, code, dst);
+
+            op->term = i;
+            op->offset = m->offset;
+            op->kind = m->is.primitive;
+
+            k->used |= (uint64_t)1 << i;
+
+            return op;
+        }
+    }
+
+    parse_error(p, "unknown term");
+
+    return NULL;
+}
+
+static void parse_expr(kernel_parser *p, int dst);
+
+static void parse_primary(kernel_parser *p, int dst)
+{
+    skip_ws(p);
+
+    char c = *p->ptr;
+
+    if(accept(p, '('))
+    {
+        parse_expr(p, dst);
+
+        if(!accept(p, ')')) parse_error(p, "expected ')'");
+    }
+    else if(accept(p, '-'))
+    {
+        parse_primary(p, dst);
+        emit(p, EcsKernelNeg, dst)->a = dst;
+    }
+    else if(c == '$')
+    {
+        p->ptr++;
+
+        if(!strncmp(p->ptr, "dt", 2) && !is_ident(p->ptr[2]))
+        {
+            emit(p, EcsKernelDeltaTime, dst);
+            p->ptr += 2;
+        }
+        else if(!strncmp(p->ptr, "time", 4) && !is_ident(p->ptr[4]))
+        {
+            emit(p, EcsKernelWorldTime, dst);
+            p->ptr += 4;
+        }
+        else parse_error(p, "unknown variable");
+    }
+    else if(isdigit((unsigned char)c) || c == '.')
+    {
+        char *end;
+        double value = strtod(p->ptr, &end);
+
+        if(end == p->ptr) parse_error(p, "invalid number");
+
+        p->ptr = end;
+
+        emit(p, EcsKernelConst, dst)->value = value;
+    }
+    else parse_member(p, EcsKernelLoad, dst);
+}
+
+static void parse_term(kernel_parser *p, int dst)
+{
+    parse_primary(p, dst);
+
+    while(true)
+    {
+        ecs_lua_kernel_opcode code;
+
+        if(accept(p, '*')) code = EcsKernelMul;
+        else if(accept(p, '/')) code = EcsKernelDiv;
+        else break;
+
+        parse_primary(p, dst + 1);
+
+        ecs_lua_kernel_op *op = emit(p, code, dst);
+        op->a = dst;
+        op->b = dst + 1;
+    }
+}
+
+static void parse_expr(kernel_parser *p, int dst)
+{
+    parse_term(p, dst);
+
+    while(true)
+    {
+        ecs_lua_kernel_opcode code;
+
+        if(accept(p, '+')) code = EcsKernelAdd;
+        else if(accept(p, '-')) code = EcsKernelSub;
+        else break;
+
+        parse_term(p, dst + 1);
+
+        ecs_lua_kernel_op *op = emit(p, code, dst);
+        op->a = dst;
+        op->b = dst + 1;
+    }
+}
+
+/* target (=|+=|-=|*=|/=) expr */
+static void parse_statement(kernel_parser *p)
+{
+    ecs_lua_kernel *k = p->k;
+
+    /* The target is parsed as a load, which is dropped for plain assignments */
+    int32_t load = k->op_count;
+    ecs_lua_kernel_op target = *parse_member(p, EcsKernelLoad, 0);
+
+    if(k->readonly[target.term]) parse_error(p, "cannot assign to [in] term");
+
+    ecs_lua_kernel_opcode code = EcsKernelStore;
+
+    skip_ws(p);
+
+    switch(*p->ptr)
+    {
+        case '+': code = EcsKernelAdd; p->ptr++; break;
+        case '-': code = EcsKernelSub; p->ptr++; break;
+        case '*': code = EcsKernelMul; p->ptr++; break;
+        case '/': code = EcsKernelDiv; p->ptr++; break;
+    }
+
+    if(!accept(p, '=')) parse_error(p, "expected assignment");
+
+    if(code == EcsKernelStore) k->op_count = load;
+
+    parse_expr(p, 1);
+
+    if(code != EcsKernelStore)
+    {
+        ecs_lua_kernel_op *op = emit(p, code, 1);
+        op->a = 0;
+        op->b = 1;
+    }
+
+    ecs_lua_kernel_op *store = emit(p, EcsKernelStore, 0);
+
+    store->a = 1;
+    store->term = target.term;
+    store->offset = target.offset;
+    store->kind = target.kind;
+
+    k->written |= (uint64_t)1 << target.term;
+}
+
+static void kernel_compile(kernel_parser *p)
+{
+    do
+    {
+        skip_ws(p);
+        if(!*p->ptr) break;
+
+        parse_statement(p);
+    }
+    while(accept(p, ';'));
+
+    skip_ws(p);
+
+    if(*p->ptr) parse_error(p, "unexpected character");
+    if(!p->k->written) parse_error(p, "kernel has no assignments");
+}
+
+#define ECS_LUA__KERNEL_KINDS(XX) \
+    XX(EcsByte, uint8_t) \
+    XX(EcsU8, uint8_t) \
+    XX(EcsU16, uint16_t) \
+    XX(EcsU32, uint32_t) \
+    XX(EcsU64, uint64_t) \
+    XX(EcsI8, int8_t) \
+    XX(EcsI16, int16_t) \
+    XX(EcsI32, int32_t) \
+    XX(EcsI64, int64_t) \
+    XX(EcsF32, float) \
+    XX(EcsF64, double)
+
+static void kernel_load(const ecs_lua_kernel_op *op, const char *col, ecs_size_t stride, int32_t n, double *restrict dst)
+{
+    int32_t j;
+
+    col += op->offset;
+
+    switch(op->kind)
+    {
+#define XX(kind, T) \
+        case kind: \
+            for(j=0; j < n; j++) dst[j] = (double)*(const T*)(col + j * stride); \
+            break;
+        ECS_LUA__KERNEL_KINDS(XX)
+#undef XX
+        default: break;
+    }
+}
+
+static void kernel_store(const ecs_lua_kernel_op *op, char *col, ecs_size_t stride, int32_t n, const double *restrict src)
+{
+    int32_t j;
+
+    col += op->offset;
+
+    switch(op->kind)
+    {
+#define XX(kind, T) \
+        case kind: \
+            for(j=0; j < n; j++) *(T*)(col + j * stride) = (T)src[j]; \
+            break;
+        ECS_LUA__KERNEL_KINDS(XX)
+#undef XX
+        default: break;
+    }
+}
+
+static void kernel_run(ecs_iter_t *it)
+{
+    ecs_lua_kernel *k = it->ctx;
+
+    char *cols[ECS_LUA__KERNEL_TERMS];
+    ecs_size_t strides[ECS_LUA__KERNEL_TERMS];
+    double regs[ECS_LUA__KERNEL_REGS][ECS_LUA__KERNEL_BLOCK];
+
+    int32_t i, j;
+
+    for(i=0; i < k->term_count; i++)
+    {
+        if(!(k->used & ((uint64_t)1 << i))) continue;
+
+        cols[i] = ecs_term_w_size(it, 0, i + 1);
+
+        if(cols[i] == NULL) return; /* Optional term not set */
+
+        bool owned = ecs_term_is_owned(it, i + 1);
+
+        if(!owned && (k->written & ((uint64_t)1 << i)))
+        {
+            ecs_os_err("kernel \"%s\": cannot write to shared term %d", ecs_get_name(it->world, it->system), i + 1);
+            return;
+        }
+
+        strides[i] = owned ? k->sizes[i] : 0;
+    }
+
+    int32_t row;
+    for(row=0; row < it->count; row += ECS_LUA__KERNEL_BLOCK)
+    {
+        int32_t n = it->count - row;
+        if(n > ECS_LUA__KERNEL_BLOCK) n = ECS_LUA__KERNEL_BLOCK;
+
+        for(i=0; i < k->op_count; i++)
+        {
+            const ecs_lua_kernel_op *op = &k->ops[i];
+
+            double *restrict dst = regs[op->dst];
+            const double *a = regs[op->a];
+            const double *b = regs[op->b];
+
+            switch(op->code)
+            {
+                case EcsKernelLoad:
+                    kernel_load(op, cols[op->term] + row * strides[op->term], strides[op->term], n, dst);
+                    break;
+                case EcsKernelStore:
+                    kernel_store(op, cols[op->term] + row * strides[op->term], strides[op->term], n, a);
+                    break;
+                case EcsKernelConst:
+                    for(j=0; j < n; j++) dst[j] = op->value;
+                    break;
+                case EcsKernelDeltaTime:
+                    for(j=0; j < n; j++) dst[j] = it->delta_time;
+                    break;
+                case EcsKernelWorldTime:
+                    for(j=0; j < n; j++) dst[j] = it->world_time;
+                    break;
+                case EcsKernelAdd:
+                    for(j=0; j < n; j++) dst[j] = a[j] + b[j];
+                    break;
+                case EcsKernelSub:
+                    for(j=0; j < n; j++) dst[j] = a[j] - b[j];
+                    break;
+                case EcsKernelMul:
+                    for(j=0; j < n; j++) dst[j] = a[j] * b[j];
+                    break;
+                case EcsKernelDiv:
+                    for(j=0; j < n; j++) dst[j] = a[j] / b[j];
+                    break;
+                case EcsKernelNeg:
+                    for(j=0; j < n; j++) dst[j] = -a[j];
+                    break;
+            }
+        }
+    }
+}
+
+static void kernel_free(void *ctx)
+{
+    ecs_os_free(ctx);
+}
+
+bool ecs_lua_is_kernel(const ecs_world_t *world, ecs_entity_t system)
+{
+    if(ecs_get_system_binding_ctx(world, system) != NULL) return false;
+
+    const ecs_lua_kernel *k = ecs_get_system_ctx(world, system);
+
+    return k != NULL && k->magic == ECS_LUA__KERNEL_MAGIC;
+}
+
+/* Resolves the terms of the signature */
+static void kernel_terms(lua_State *L, ecs_world_t *w, ecs_lua_kernel *k, const char *signature)
+{
+    ecs_filter_t filter;
+    ecs_filter_desc_t desc = { .expr = signature };
+
+    if(ecs_filter_init(w, &filter, &desc)) luaL_argerror(L, 3, "invalid signature");
+
+    int32_t i, count = filter.term_count;
+
+    if(count > ECS_LUA__KERNEL_TERMS)
+    {
+        ecs_filter_fini(&filter);
+        luaL_argerror(L, 3, "too many terms");
+    }
+
+    for(i=0; i < count; i++)
+    {
+        ecs_term_t *term = &filter.terms[i];
+        const EcsComponent *c = ecs_get(w, term->id, EcsComponent);
+
+        k->ids[i] = term->id;
+        k->sizes[i] = c ? c->size : 0;
+        k->readonly[i] = term->inout == EcsIn || term->oper == EcsNot;
+    }
+
+    k->term_count = count;
+
+    ecs_filter_fini(&filter);
+}
+
+int new_kernel(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    const char *name = luaL_checkstring(L, 1);
+    ecs_entity_t phase = luaL_checkinteger(L, 2);
+    const char *signature = luaL_checkstring(L, 3);
+    const char *expr = luaL_checkstring(L, 4);
+
+    /* Compiled into a Lua-owned buffer so errors don't leak */
+    ecs_lua_kernel *k = lua_newuserdata(L, sizeof(ecs_lua_kernel));
+    memset(k, 0, sizeof(ecs_lua_kernel));
+
+    k->magic = ECS_LUA__KERNEL_MAGIC;
+
+    kernel_terms(L, w, k, signature);
+
+    kernel_parser p = { .L = L, .world = w, .k = k, .expr = expr, .ptr = expr };
+
+    kernel_compile(&p);
+
+    ecs_lua_kernel *ctx = ecs_os_malloc_t(ecs_lua_kernel);
+    memcpy(ctx, k, sizeof(ecs_lua_kernel));
+
+    ecs_system_desc_t desc =
+    {
+        .entity = { .name = name, .add = phase },
+        .query.filter.expr = signature,
+        .callback = kernel_run,
+        .ctx = ctx,
+        .ctx_free = kernel_free
+    };
+
+    ecs_entity_t e = ecs_system_init(w, &desc);
+
+    if(!e)
+    {
+        ecs_os_free(ctx);
+        return luaL_error(L, "failed to create kernel");
+    }
+
+    lua_pushinteger(L, e);
+
+    return 1;
+}
@@ -10,6 +10,7 @@ typedef struct ecs_lua_col_t
     void *ptr;
     const EcsMetaTypeSerializer *ser;
     ecs_meta_cursor_t *cursor;
+    int32_t primitive; /* ecs_primitive_kind_t or -1 */
 }ecs_lua_col_t;
 
 typedef struct ecs_lua_each_t
@@ -17,6 +18,7 @@ typedef struct ecs_lua_each_t
     ecs_iter_t *it;
     int32_t i;
     bool from_query, read_prev;
+    uint64_t readonly;
     ecs_lua_col_t cols[];
 }ecs_lua_each_t;
 
@@ -34,14 +36,9 @@ void serialize_type_op(
     const void *base,
     lua_State *L);
 
-static
-void serialize_primitive(
-    const ecs_world_t *world,
-    ecs_type_op_t *op,
-    const void *base,
-    lua_State *L)
+void ecs_lua_push_primitive(lua_State *L, ecs_primitive_kind_t kind, const void *base)
 {
-    switch(op->is.primitive)
+    switch(kind)
     {
         case EcsBool:
             lua_pushboolean(L, (int)*(bool*)base);
@@ -95,7 +92,84 @@ void serialize_primitive(
             lua_pushinteger(L, *(uintptr_t*)base);
             break;
         default:
-            luaL_error(L, "unknown primitive (%d)", op->is.primitive);
+            luaL_error(L, "unknown primitive (%d)", kind);
+    }
+}
+
+static lua_Integer checkint(lua_State *L, int arg)
+{
+    if(lua_type(L, arg) == LUA_TBOOLEAN) return lua_toboolean(L, arg);
+    if(lua_isinteger(L, arg)) return lua_tointeger(L, arg);
+
+    return (lua_Integer)luaL_checknumber(L, arg);
+}
+
+void ecs_lua_check_primitive(lua_State *L, int arg, ecs_primitive_kind_t kind, void *base)
+{
+    switch(kind)
+    {
+        case EcsBool:
+            if(lua_type(L, arg) == LUA_TNUMBER) *(bool*)base = lua_tonumber(L, arg) != 0;
+            else *(bool*)base = lua_toboolean(L, arg);
+            break;
+        case EcsChar:
+            *(char*)base = (char)checkint(L, arg);
+            break;
+        case EcsString:
+        {
+            char **str = base;
+            const char *value = NULL;
+
+            if(lua_type(L, arg) == LUA_TSTRING) value = lua_tostring(L, arg);
+            else if(!lua_isnil(L, arg) && checkint(L, arg) != 0)
+                luaL_error(L, "expected string (got %s)", luaL_typename(L, arg));
+
+            ecs_os_free(*str);
+            *str = value ? ecs_os_strdup(value) : NULL;
+            break;
+        }
+        case EcsByte:
+        case EcsU8:
+            *(uint8_t*)base = (uint8_t)checkint(L, arg);
+            break;
+        case EcsU16:
+            *(uint16_t*)base = (uint16_t)checkint(L, arg);
+            break;
+        case EcsU32:
+            *(uint32_t*)base = (uint32_t)checkint(L, arg);
+            break;
+        case EcsU64:
+            *(uint64_t*)base = (uint64_t)checkint(L, arg);
+            break;
+        case EcsI8:
+            *(int8_t*)base = (int8_t)checkint(L, arg);
+            break;
+        case EcsI16:
+            *(int16_t*)base = (int16_t)checkint(L, arg);
+            break;
+        case EcsI32:
+            *(int32_t*)base = (int32_t)checkint(L, arg);
+            break;
+        case EcsI64:
+            *(int64_t*)base = (int64_t)checkint(L, arg);
+            break;
+        case EcsF32:
+            *(float*)base = (float)luaL_checknumber(L, arg);
+            break;
+        case EcsF64:
+            *(double*)base = (double)luaL_checknumber(L, arg);
+            break;
+        case EcsEntity:
+            *(ecs_entity_t*)base = (ecs_entity_t)checkint(L, arg);
+            break;
+        case EcsIPtr:
+            *(intptr_t*)base = (intptr_t)checkint(L, arg);
+            break;
+        case EcsUPtr:
+            *(uintptr_t*)base = (uintptr_t)checkint(L, arg);
+            break;
+        default:
+            luaL_error(L, "unknown primitive (%d)", kind);
     }
 }
 
@@ -109,6 +183,18 @@ void serialize_int32(
     lua_pushinteger(L, value);
 }
 
+bool ecs_lua_is_primitive(const EcsMetaTypeSerializer *ser)
+{
+    ecs_assert(ser != NULL, ECS_INVALID_PARAMETER, NULL);
+
+    ecs_type_op_t *ops = (ecs_type_op_t*)ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t count = ecs_vector_count(ser->ops);
+
+    if(count != 2) return false;
+
+    return ops[1].kind == EcsOpPrimitive;
+}
+
 static
 void serialize_elements(
     const ecs_world_t *world,
@@ -120,12 +206,18 @@ void serialize_elements(
 {
     const void *ptr = base;
 
+    /* Elements of a primitive type are pushed directly */
+    ecs_type_op_t *ops = ecs_vector_first(elem_ops, ecs_type_op_t);
+    bool primitive = ecs_vector_count(elem_ops) == 2 && ops[1].kind == EcsOpPrimitive;
+
     lua_createtable(L, elem_count, 0);
 
     int i;
     for(i=0; i < elem_count; i++)
     {
-        serialize_type(world, elem_ops, ptr, L);
+        if(primitive) ecs_lua_push_primitive(L, ops[1].is.primitive, ptr);
+        else serialize_type(world, elem_ops, ptr, L);
+
         lua_rawseti(L, -2, i + 1);
 
         ptr = ECS_OFFSET(ptr, elem_size);
@@ -175,6 +267,57 @@ void serialize_vector(
     serialize_elements(world, elem_ops, array, count, elem_size, L);
 }
 
+/* Map keys are integers widened to 64 bits, signed keys are sign-extended */
+static bool map_key_integer(ecs_type_op_t *key_op)
+{
+    if(key_op->kind != EcsOpPrimitive) return false;
+
+    switch(key_op->is.primitive)
+    {
+        case EcsBool:
+        case EcsF32:
+        case EcsF64:
+        case EcsString:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool map_key_signed(ecs_type_op_t *key_op)
+{
+    switch(key_op->is.primitive)
+    {
+        case EcsI8:
+        case EcsI16:
+        case EcsI32:
+        case EcsI64:
+        case EcsIPtr:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static ecs_map_key_t check_map_key(lua_State *L, int idx, ecs_type_op_t *key_op, ecs_size_t size)
+{
+    lua_Integer key = luaL_checkinteger(L, idx);
+    int bits = size * 8;
+
+    if(bits < 64)
+    {
+        lua_Integer max = (lua_Integer)1 << bits;
+        bool valid;
+
+        if(map_key_signed(key_op)) valid = key >= -max / 2 && key < max / 2;
+        else valid = key >= 0 && key < max;
+
+        if(!valid) luaL_error(L, "map key %I is out of range", key);
+    }
+
+    return (ecs_map_key_t)key;
+}
+
 static
 void serialize_map(
     const ecs_world_t *world,
@@ -184,6 +327,12 @@ void serialize_map(
 {
     ecs_map_t *value = *(ecs_map_t**)base;
 
+    if(!value)
+    {
+        lua_pushnil(L);
+        return;
+    }
+
     const EcsMetaTypeSerializer *key_ser = ecs_get_ref_w_id(world, &op->is.map.key, 0, 0);
     ecs_assert(key_ser != NULL, ECS_INTERNAL_ERROR, NULL);
 
@@ -201,12 +350,17 @@ void serialize_map(
     ecs_map_key_t key;
     void *ptr;
 
-    lua_createtable(L, 0, 0);
+    lua_createtable(L, 0, ecs_map_count(value));
+
+    bool integer = map_key_integer(key_op);
 
     while((ptr = _ecs_map_next(&it, 0, &key)))
     {
-        serialize_type_op(world, key_op, (void*)&key, L);
+        if(integer) lua_pushinteger(L, (lua_Integer)key);
+        else serialize_type_op(world, key_op, (void*)&key, L);
+
         serialize_type(world, elem_ser->ops, ptr, L);
+        lua_settable(L, -3);
 
         key = 0;
     }
@@ -227,7 +381,7 @@ void serialize_type_op(
         ecs_abort(ECS_INVALID_PARAMETER, NULL);
         break;
     case EcsOpPrimitive:
-        serialize_primitive(world, op, ECS_OFFSET(base, op->offset), L);
+        ecs_lua_push_primitive(L, op->is.primitive, ECS_OFFSET(base, op->offset));
         break;
     case EcsOpEnum:
         serialize_int32(op, ECS_OFFSET(base, op->offset), L);
@@ -242,7 +396,7 @@ void serialize_type_op(
         serialize_vector(world, op, ECS_OFFSET(base, op->offset), L);
         break;
     case EcsOpMap:
-       // serialize_map(world, op, ECS_OFFSET(base, op->offset), L);
+        serialize_map(world, op, ECS_OFFSET(base, op->offset), L);
         break;
     }
 }
@@ -404,8 +558,610 @@ void update_type(
             }
         }
     }
-
-    lua_pop(L, 1);
+
+    lua_pop(L, 1);
+}
+
+void ecs_lua_serialize_op(
+    const ecs_world_t *world,
+    lua_State *L,
+    ecs_type_op_t *op,
+    const void *base)
+{
+    serialize_type_op(world, op, base, L);
+}
+
+void ecs_lua_serialize_scope(
+    const ecs_world_t *world,
+    lua_State *L,
+    ecs_type_op_t *ops,
+    int32_t scope,
+    const void *base)
+{
+    ecs_assert(ops[scope].kind == EcsOpPush, ECS_INVALID_PARAMETER, NULL);
+
+    int32_t i, depth = 0;
+
+    for(i=scope; ; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+
+        switch(op->kind)
+        {
+            case EcsOpPush:
+            {
+                if(depth++) lua_pushstring(L, op->name);
+                lua_createtable(L, 0, op->count);
+                break;
+            }
+            case EcsOpPop:
+            {
+                if(!--depth) return;
+                lua_settable(L, -3);
+                break;
+            }
+            default:
+            {
+                serialize_type_op(world, op, base, L);
+                if(op->name) lua_setfield(L, -2, op->name);
+                break;
+            }
+        }
+    }
+}
+
+/* Pushes the field lookup plan for a serializer:
+   plan[push_op] = { name = op, [n] = op, ... } for every scope */
+static void push_plan(lua_State *L, const ecs_vector_t *ser, bool *use_cursor)
+{
+    ecs_type_op_t *ops = (ecs_type_op_t*)ecs_vector_first(ser, ecs_type_op_t);
+    int32_t count = ecs_vector_count(ser);
+
+    /* Only types without members are left to the cursor */
+    *use_cursor = count < 2;
+
+    lua_newtable(L);
+
+    int32_t i, j, n, depth;
+
+    for(i=0; i < count; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+
+        if(op->kind != EcsOpPush) continue;
+
+        lua_createtable(L, op->count, op->count);
+
+        for(j=i + 1, n=0, depth=0; j < count; j++)
+        {
+            if(ops[j].kind == EcsOpPop)
+            {
+                if(!depth) break;
+
+                depth--;
+                continue;
+            }
+
+            if(!depth)
+            {
+                lua_pushinteger(L, j);
+                lua_rawseti(L, -2, ++n);
+
+                if(ops[j].name)
+                {
+                    lua_pushinteger(L, j);
+                    lua_setfield(L, -2, ops[j].name);
+                }
+            }
+
+            if(ops[j].kind == EcsOpPush) depth++;
+        }
+
+        lua_rawseti(L, -2, i);
+    }
+}
+
+/* Entry in the ECS_LUA_TYPES cache, the plan is stored as uservalue */
+typedef struct ecs_lua_type_t
+{
+    ecs_ref_t ref;
+    bool use_cursor; /* Types without ops are deserialized with a cursor */
+    int32_t primitive; /* ecs_primitive_kind_t of single-primitive types, -1 otherwise */
+}ecs_lua_type_t;
+
+static ecs_lua_type_t *get_type(lua_State *L, const ecs_world_t *world, ecs_entity_t type, bool plan)
+{
+    world = ecs_get_world(world);
+
+    int ret = lua_rawgetp(L, LUA_REGISTRYINDEX, world);
+    ecs_assert(ret == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
+
+    ret = lua_rawgeti(L, -1, ECS_LUA_TYPES);
+    ecs_assert(ret == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
+
+    ret = lua_rawgeti(L, -1, type);
+
+    ecs_lua_type_t *t;
+
+    if(ret != LUA_TNIL)
+    {
+        ecs_assert(ret == LUA_TUSERDATA, ECS_INTERNAL_ERROR, NULL);
+
+        t = lua_touserdata(L, -1);
+    }
+    else
+    {
+        lua_pop(L, 1); /* -nil */
+        t = lua_newuserdata(L, sizeof(ecs_lua_type_t));
+
+        t->ref = (ecs_ref_t){ .entity = type, .component = ecs_id(EcsMetaTypeSerializer) };
+
+        const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(world, &t->ref, 0, 0);
+        if(!ser) luaL_error(L, "type %I cannot be serialized", type);
+
+        t->primitive = ecs_lua_is_primitive(ser) ? ecs_vector_first(ser->ops, ecs_type_op_t)[1].is.primitive : -1;
+
+        push_plan(L, ser->ops, &t->use_cursor);
+        lua_setuservalue(L, -2);
+
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, type);
+    }
+
+    if(plan)
+    {
+        lua_getuservalue(L, -1);
+        lua_replace(L, -4);
+        lua_pop(L, 2); /* -type, -types */
+    }
+    else lua_pop(L, 3); /* -type, -types, -world */
+
+    return t;
+}
+
+const EcsMetaTypeSerializer *ecs_lua_get_serializer(lua_State *L, const ecs_world_t *world, ecs_entity_t type)
+{
+    ecs_lua_type_t *t = get_type(L, world, type, false);
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    return ser;
+}
+
+const EcsMetaTypeSerializer *ecs_lua_push_plan(lua_State *L, const ecs_world_t *world, ecs_entity_t type, bool *use_cursor)
+{
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+
+    if(use_cursor) *use_cursor = t->use_cursor;
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    return ser;
+}
+
+int32_t ecs_lua_find_member(lua_State *L, int plan, int32_t scope, int key)
+{
+    int32_t member = -1;
+
+    key = lua_absindex(L, key);
+
+    if(lua_rawgeti(L, plan, scope) == LUA_TTABLE)
+    {
+        lua_pushvalue(L, key);
+        if(lua_rawget(L, -2) == LUA_TNUMBER) member = lua_tointeger(L, -1);
+
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+
+    return member;
+}
+
+ecs_type_op_t *ecs_lua_member_op(ecs_type_op_t *ops, int32_t count, const char *path)
+{
+    ecs_type_op_t *found = NULL;
+    int32_t i = 1; /* EcsOpPush of the struct */
+
+    if(count < 2 || ops[1].kind != EcsOpPush) return NULL;
+
+    while(path)
+    {
+        const char *dot = strchr(path, '.');
+        size_t len = dot ? (size_t)(dot - path) : strlen(path);
+        int depth = 0;
+
+        found = NULL;
+
+        for(i = i + 1; i < count; i++)
+        {
+            ecs_type_op_t *op = &ops[i];
+
+            if(op->kind == EcsOpPop)
+            {
+                if(!depth--) break;
+                continue;
+            }
+
+            if(!depth && op->name && !strncmp(op->name, path, len) && !op->name[len])
+            {
+                found = op;
+                break;
+            }
+
+            if(op->kind == EcsOpPush) depth++;
+        }
+
+        if(found == NULL) return NULL;
+
+        path = dot ? dot + 1 : NULL;
+
+        if(path && found->kind != EcsOpPush) return NULL;
+    }
+
+    return found;
+}
+
+static
+void deserialize_scope(
+    const ecs_world_t *world,
+    lua_State *L,
+    int arg,
+    ecs_type_op_t *ops,
+    int32_t count,
+    int32_t scope,
+    void *base,
+    int plan)
+{
+    int ktype, mtype = 0;
+    int32_t member;
+
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    lua_rawgeti(L, plan, scope);
+    int members = lua_gettop(L);
+
+    lua_pushnil(L);
+
+    while(lua_next(L, arg))
+    {
+        ktype = lua_type(L, -2);
+
+        if(!mtype) mtype = ktype;
+
+        if(ktype != LUA_TSTRING && ktype != LUA_TNUMBER)
+            luaL_error(L, "invalid key type '%s'", lua_typename(L, ktype));
+
+        lua_pushvalue(L, -2);
+        member = lua_rawget(L, members) == LUA_TNUMBER ? lua_tointeger(L, -1) : -1;
+        lua_pop(L, 1);
+
+        if(ktype == LUA_TSTRING)
+        {
+            const char *key = lua_tostring(L, -2);
+
+            if(member < 0) luaL_error(L, "field \"%s\" does not exist", key);
+            if(mtype != ktype) luaL_error(L, "table has mixed key types (string key '%s')", key);
+        }
+        else
+        {
+            lua_Integer key = lua_tointeger(L, -2) - 1;
+
+            if(member < 0) luaL_error(L, "invalid index %I (Lua [%I])", key, key + 1);
+            if(mtype != ktype) luaL_error(L, "table has mixed key types (int key [%I]", key+1);
+        }
+
+        ecs_lua_deserialize_op(world, L, -1, ops, count, member, base, plan);
+
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1); /* members */
+}
+
+static
+void deserialize_array(
+    const ecs_world_t *world,
+    lua_State *L,
+    int arg,
+    ecs_type_op_t *op,
+    void *base)
+{
+    ecs_entity_t type = op->is.collection.entity;
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+    int plan = lua_gettop(L);
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t count = ecs_vector_count(ser->ops);
+
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    lua_pushnil(L);
+
+    while(lua_next(L, arg))
+    {
+        if(!lua_isinteger(L, -2)) luaL_error(L, "invalid key type '%s'", luaL_typename(L, -2));
+
+        lua_Integer key = lua_tointeger(L, -2) - 1;
+
+        if(key < 0 || key >= op->count) luaL_error(L, "invalid index %I (Lua [%I])", key, key + 1);
+
+        void *ptr = ECS_OFFSET(base, key * op->size);
+
+        if(t->use_cursor) ecs_lua_to_ptr(world, L, -1, type, ptr);
+        else ecs_lua_deserialize_op(world, L, -1, ops, count, 1, ptr, plan);
+
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1); /* plan */
+}
+
+static void fini_elements(const ecs_world_t *world, ecs_entity_t type, void *array, ecs_size_t size, int32_t n);
+
+/* Frees the strings, vectors and maps owned by a value */
+static void fini_value(const ecs_world_t *world, ecs_type_op_t *ops, int32_t count, void *base)
+{
+    int32_t i;
+    for(i=1; i < count; i++)
+    {
+        ecs_type_op_t *op = &ops[i];
+        void *ptr = ECS_OFFSET(base, op->offset);
+
+        switch(op->kind)
+        {
+            case EcsOpPrimitive:
+            {
+                if(op->is.primitive != EcsString) break;
+
+                ecs_os_free(*(char**)ptr);
+                *(char**)ptr = NULL;
+                break;
+            }
+            case EcsOpArray:
+                fini_elements(world, op->is.collection.entity, ptr, op->size, op->count);
+                break;
+            case EcsOpVector:
+            {
+                ecs_vector_t **vec = ptr;
+                const EcsMetaTypeSerializer *ser = ecs_get(ecs_get_world(world), op->is.collection.entity, EcsMetaTypeSerializer);
+
+                if(*vec == NULL || ser == NULL) break;
+
+                ecs_type_op_t *elem = ecs_vector_first(ser->ops, ecs_type_op_t);
+
+                fini_elements(world, op->is.collection.entity,
+                    ecs_vector_first_t(*vec, elem->size, elem->alignment), elem->size, ecs_vector_count(*vec));
+
+                ecs_vector_free(*vec);
+                *vec = NULL;
+                break;
+            }
+            case EcsOpMap:
+            {
+                ecs_map_t **map = ptr;
+                const EcsMetaTypeSerializer *ser = ecs_get(ecs_get_world(world), op->is.map.element.entity, EcsMetaTypeSerializer);
+
+                if(*map == NULL || ser == NULL) break;
+
+                ecs_type_op_t *elem = ecs_vector_first(ser->ops, ecs_type_op_t);
+                ecs_map_iter_t it = ecs_map_iter(*map);
+                void *value;
+
+                while((value = _ecs_map_next(&it, elem->size, NULL)))
+                {
+                    fini_elements(world, op->is.map.element.entity, value, elem->size, 1);
+                }
+
+                ecs_map_free(*map);
+                *map = NULL;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/* Elements dropped by resizing a vector or clearing a map would leak what they own */
+static void fini_elements(const ecs_world_t *world, ecs_entity_t type, void *array, ecs_size_t size, int32_t n)
+{
+    const EcsMetaTypeSerializer *ser = ecs_get(ecs_get_world(world), type, EcsMetaTypeSerializer);
+
+    if(ser == NULL) return;
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t i, count = ecs_vector_count(ser->ops);
+
+    for(i=0; i < n; i++) fini_value(world, ops, count, ECS_OFFSET(array, i * size));
+}
+
+/* The vector is resized once to the length of the sequence */
+static
+void deserialize_vector(
+    const ecs_world_t *world,
+    lua_State *L,
+    int arg,
+    ecs_type_op_t *op,
+    void *base)
+{
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    ecs_entity_t type = op->is.collection.entity;
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+    int plan = lua_gettop(L);
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t count = ecs_vector_count(ser->ops);
+
+    ecs_size_t size = ops[0].size;
+    int16_t alignment = ops[0].alignment;
+
+    ecs_vector_t **vec = base;
+    int32_t i, n = (int32_t)lua_rawlen(L, arg);
+    int32_t prev = ecs_vector_count(*vec);
+
+    if(n < prev)
+    {
+        fini_elements(world, type, ECS_OFFSET(ecs_vector_first_t(*vec, size, alignment), n * size), size, prev - n);
+    }
+
+    ecs_vector_set_count_t(vec, size, alignment, n);
+
+    void *array = ecs_vector_first_t(*vec, size, alignment);
+
+    if(n > prev) memset(ECS_OFFSET(array, prev * size), 0, (size_t)(n - prev) * size);
+
+    if(t->primitive >= 0)
+    {
+        for(i=0; i < n; i++)
+        {
+            lua_rawgeti(L, arg, i + 1);
+            ecs_lua_check_primitive(L, -1, t->primitive, ECS_OFFSET(array, i * size));
+            lua_pop(L, 1);
+        }
+    }
+    else
+    {
+        for(i=0; i < n; i++)
+        {
+            void *ptr = ECS_OFFSET(array, i * size);
+
+            lua_rawgeti(L, arg, i + 1);
+
+            if(t->use_cursor) ecs_lua_to_ptr(world, L, -1, type, ptr);
+            else ecs_lua_deserialize_op(world, L, -1, ops, count, 1, ptr, plan);
+
+            lua_pop(L, 1);
+        }
+    }
+
+    lua_pop(L, 1); /* plan */
+}
+
+/* The map is replaced by the contents of the table */
+static
+void deserialize_map(
+    const ecs_world_t *world,
+    lua_State *L,
+    int arg,
+    ecs_type_op_t *op,
+    void *base)
+{
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    const EcsMetaTypeSerializer *key_ser = ecs_get_ref_w_id(ecs_get_world(world), &op->is.map.key, 0, 0);
+    ecs_assert(key_ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    ecs_type_op_t *key_op = ecs_vector_get(key_ser->ops, ecs_type_op_t, 1);
+
+    if(ecs_vector_count(key_ser->ops) != 2 || !map_key_integer(key_op))
+        luaL_error(L, "unsupported key type for map \"%s\"", op->name ? op->name : "(element)");
+
+    ecs_entity_t type = op->is.map.element.entity;
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+    int plan = lua_gettop(L);
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t count = ecs_vector_count(ser->ops);
+    ecs_size_t size = ops[0].size;
+
+    ecs_map_t **map = base;
+
+    if(*map)
+    {
+        ecs_map_iter_t it = ecs_map_iter(*map);
+        void *value;
+
+        while((value = _ecs_map_next(&it, size, NULL))) fini_elements(world, type, value, size, 1);
+
+        ecs_map_clear(*map);
+    }
+    else *map = _ecs_map_new(size, 0);
+
+    /* Elements are written here and copied into the map */
+    void *elem = lua_newuserdata(L, size);
+
+    lua_pushnil(L);
+
+    while(lua_next(L, arg))
+    {
+        ecs_map_key_t key = check_map_key(L, -2, key_op, ecs_vector_first(key_ser->ops, ecs_type_op_t)->size);
+
+        memset(elem, 0, size);
+
+        if(t->primitive >= 0) ecs_lua_check_primitive(L, -1, t->primitive, elem);
+        else if(t->use_cursor) ecs_lua_to_ptr(world, L, -1, type, elem);
+        else ecs_lua_deserialize_op(world, L, -1, ops, count, 1, elem, plan);
+
+        _ecs_map_set(*map, size, key, elem);
+
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 2); /* elem, plan */
+}
+
+void ecs_lua_deserialize_op(
+    const ecs_world_t *world,
+    lua_State *L,
+    int arg,
+    ecs_type_op_t *ops,
+    int32_t count,
+    int32_t index,
+    void *base,
+    int plan)
+{
+    ecs_type_op_t *op = &ops[index];
+
+    arg = lua_absindex(L, arg);
+
+    switch(op->kind)
+    {
+        case EcsOpPrimitive:
+            ecs_lua_check_primitive(L, arg, op->is.primitive, ECS_OFFSET(base, op->offset));
+            break;
+        case EcsOpEnum:
+        case EcsOpBitmask:
+        {
+            void *ptr = ECS_OFFSET(base, op->offset);
+
+            if(lua_type(L, arg) == LUA_TSTRING)
+            {/* Constant names are resolved by the meta cursor */
+                ecs_meta_cursor_t c = ecs_meta_cursor(world, op->type, ptr);
+
+                if(ecs_meta_set_string(&c, lua_tostring(L, arg)))
+                    luaL_error(L, "invalid constant \"%s\"", lua_tostring(L, arg));
+            }
+            else *(int32_t*)ptr = (int32_t)luaL_checkinteger(L, arg);
+            break;
+        }
+        case EcsOpPush:
+            deserialize_scope(world, L, arg, ops, count, index, base, plan);
+            break;
+        case EcsOpArray:
+            deserialize_array(world, L, arg, op, ECS_OFFSET(base, op->offset));
+            break;
+        case EcsOpVector:
+            deserialize_vector(world, L, arg, op, ECS_OFFSET(base, op->offset));
+            break;
+        case EcsOpMap:
+            deserialize_map(world, L, arg, op, ECS_OFFSET(base, op->offset));
+            break;
+        default:
+            luaL_error(L, "cannot assign to \"%s\"", op->name ? op->name : "(element)");
+    }
 }
 
 static void deserialize_type(lua_State *L, int idx, ecs_meta_cursor_t *c)
@@ -538,59 +1294,44 @@ void serialize_column(
     serialize_elements(world, ser->ops, base, count, hdr->size, L);
 }
 
-static const EcsMetaTypeSerializer *get_serializer(lua_State *L, const ecs_world_t *world, ecs_entity_t type)
+static int columns__len(lua_State *L)
 {
-    //return ecs_get(world, type, EcsMetaTypeSerializer);
-
-    world = ecs_get_world(world);
-
-    int ret = lua_rawgetp(L, LUA_REGISTRYINDEX, world);
-    ecs_assert(ret == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
-
-    ret = lua_rawgeti(L, -1, ECS_LUA_TYPES);
-    ecs_assert(ret == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
-
-    ret = lua_rawgeti(L, -1, type);
-
-    ecs_ref_t *ref;
+    ecs_iter_t *it = lua_touserdata(L, lua_upvalueindex(1));
 
-    if(ret != LUA_TNIL)
-    {
-        ecs_assert(ret == LUA_TUSERDATA, ECS_INTERNAL_ERROR, NULL);
+    lua_pushinteger(L, it->count ? it->column_count : 0);
 
-        ref = lua_touserdata(L, -1);
+    return 1;
+}
 
-        lua_pop(L, 3);
-    }
-    else
-    {
-        lua_pop(L, 1); /* -nil */
-        ref = lua_newuserdata(L, sizeof(ecs_ref_t));
-        lua_rawseti(L, -2, type);
+/* readonly is the callback's bitmask of [in] terms */
+static bool is_readonly(ecs_iter_t *it, int32_t i, uint64_t readonly)
+{
+    if(i <= 64 && readonly & ((uint64_t)1 << (i - 1))) return true;
 
-        *ref = (ecs_ref_t){ .entity = type, .component = ecs_id(EcsMetaTypeSerializer) };
+    return it->query && ecs_term_is_readonly(it, i);
+}
 
-        lua_pop(L, 2); /* -types, -world */
-    }
+/* Returns the readonly bitmask of the iterator at the given index */
+static uint64_t iter_readonly(lua_State *L, int idx)
+{
+    if(luaL_getmetafield(L, idx, "__ecs_readonly") == LUA_TNIL) return 0;
 
-    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(world, ref, 0, 0);
-    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
+    uint64_t readonly = lua_tointeger(L, -1);
+    lua_pop(L, 1);
 
-    return ser;
+    return readonly;
 }
 
-static int columns__len(lua_State *L)
+bool ecs_lua_term_readonly(lua_State *L, int idx, ecs_iter_t *it, int32_t i)
 {
-    ecs_iter_t *it = lua_touserdata(L, lua_upvalueindex(1));
-
-    lua_pushinteger(L, it->column_count);
-
-    return 1;
+    return is_readonly(it, i, iter_readonly(L, idx));
 }
 
 static int columns__index(lua_State *L)
 {
     ecs_iter_t *it = lua_touserdata(L, lua_upvalueindex(1));
+    int flags = lua_tointeger(L, lua_upvalueindex(2));
+    uint64_t readonly = lua_tointeger(L, lua_upvalueindex(3));
     ecs_world_t *world = it->world;
 
     lua_Integer i = luaL_checkinteger(L, 2);
@@ -604,16 +1345,37 @@ static int columns__index(lua_State *L)
     }
 
     ecs_entity_t type = ecs_get_typeid(world, ecs_term_id(it, i));
-    const EcsMetaTypeSerializer *ser = get_serializer(L, world, type);
-
-    if(!ser) luaL_error(L, "term %d cannot be serialized", i);
 
     lua_settop(L, 1); /* (it.)columns */
 
-    const void *base = ecs_term_w_size(it, 0, i);
+    bool owned = ecs_term_is_owned(it, i);
+    bool ro = is_readonly(it, i, readonly);
+
+    /* Columns of bare values have no rows to view or track */
+    if(get_type(L, world, type, false)->primitive >= 0) flags = 0;
+
+    if(flags & ECS_LUA__PROXY)
+    {
+        ecs_lua_push_proxy(L, it, i, type, ro);
+
+        /* Only views are cached, values are copies */
+        if(lua_type(L, -1) != LUA_TUSERDATA) return 1;
+    }
+    else if(!(flags & ECS_LUA__TRACK) || !owned || ro ||
+        !ecs_lua_push_tracked(L, it, i, type))
+    {
+        const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, world, type);
+
+        if(!ser) luaL_error(L, "term %d cannot be serialized", i);
 
-    if(!ecs_term_is_owned(it, i)) serialize_type(world, ser->ops, base, L);
-    else serialize_column(world, L, ser, base, it->count);
+        const void *base = ecs_term_w_size(it, 0, i);
+
+        if(!owned) serialize_type(world, ser->ops, base, L);
+        else serialize_column(world, L, ser, base, it->count);
+
+        /* Never written back */
+        if(ro && lua_type(L, -1) == LUA_TTABLE) luaL_setmetatable(L, "ecs_readonly");
+    }
 
     lua_pushvalue(L, -1);
     lua_rawseti(L, -3, i);
@@ -639,15 +1401,8 @@ static int entities__index(lua_State *L)
 }
 
 /* expects "it" table at stack top */
-static void push_columns(lua_State *L, ecs_iter_t *it)
+static void push_columns_table(lua_State *L, ecs_iter_t *it, int flags, uint64_t readonly)
 {
-    if(!it->count)
-    {
-        lua_newtable(L);
-        lua_setfield(L, -2, "columns");
-        return;
-    }
-
     /* it.columns[] */
     lua_createtable(L, it->column_count, 1);
 
@@ -655,7 +1410,9 @@ static void push_columns(lua_State *L, ecs_iter_t *it)
     lua_createtable(L, 0, 2);
 
     lua_pushlightuserdata(L, it);
-    lua_pushcclosure(L, columns__index, 1);
+    lua_pushinteger(L, flags);
+    lua_pushinteger(L, readonly);
+    lua_pushcclosure(L, columns__index, 3);
     lua_setfield(L, -2, "__index");
 
     lua_pushlightuserdata(L, it);
@@ -668,7 +1425,20 @@ static void push_columns(lua_State *L, ecs_iter_t *it)
 }
 
 /* expects "it" table at stack top */
-static void push_iter_metadata(lua_State *L, ecs_iter_t *it)
+static void push_columns(lua_State *L, ecs_iter_t *it, int flags, uint64_t readonly)
+{
+    if(!it->count)
+    {
+        lua_newtable(L);
+        lua_setfield(L, -2, "columns");
+        return;
+    }
+
+    push_columns_table(L, it, flags, readonly);
+}
+
+/* expects "it" table at stack top */
+static void push_iter_fields(lua_State *L, ecs_iter_t *it)
 {
     /* it.count */
     lua_pushinteger(L, it->count);
@@ -708,7 +1478,8 @@ static void push_iter_metadata(lua_State *L, ecs_iter_t *it)
     {
         ecs_lua_callback *sys = it->binding_ctx;
 
-        if(sys->param_ref >= 0)
+        /* Only the main state holds the context */
+        if(sys->param_ref >= 0 && L == sys->states[0].L)
         {
             int type = ecs_lua_rawgeti(L, it->world, sys->param_ref);
             ecs_assert(type != LUA_TNIL, ECS_INTERNAL_ERROR, NULL);
@@ -720,6 +1491,12 @@ static void push_iter_metadata(lua_State *L, ecs_iter_t *it)
 
         lua_setfield(L, -2, "param");
     }
+}
+
+/* expects "it" table at stack top */
+static void push_iter_metadata(lua_State *L, ecs_iter_t *it)
+{
+    push_iter_fields(L, it);
 
     /* it.entities */
     lua_createtable(L, 0, 1);
@@ -738,10 +1515,20 @@ static void push_iter_metadata(lua_State *L, ecs_iter_t *it)
 }
 
 /* expects table at stack top */
-static ecs_iter_t *push_iter_metafield(lua_State *L, ecs_iter_t *it, bool copy)
+static ecs_iter_t *push_iter_metafield(lua_State *L, ecs_iter_t *it, bool copy, uint64_t readonly)
 {
     /* metatable */
-    lua_createtable(L, 0, 1);
+    lua_createtable(L, 0, 3);
+
+    /* it:method() */
+    luaL_getmetatable(L, "ecs_iter_t");
+    lua_setfield(L, -2, "__index");
+
+    if(readonly)
+    {
+        lua_pushinteger(L, readonly);
+        lua_setfield(L, -2, "__ecs_readonly");
+    }
 
     /* metatable.__ecs_iter = it */
     if(copy)
@@ -818,18 +1605,51 @@ void deserialize_column(
     size_t stride,
     int32_t count)
 {
-    ecs_meta_cursor_t *c = ecs_lua_cursor(L, world, type, base);
+    idx = lua_absindex(L, idx);
+
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+    int plan = lua_gettop(L);
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+    int32_t op_count = ecs_vector_count(ser->ops);
+
+    ecs_meta_cursor_t *c = NULL;
+
+    if(t->use_cursor) c = ecs_lua_cursor(L, world, type, base);
 
     int j;
+
+    if(t->primitive >= 0)
+    {
+        for(j=0; j < count; j++)
+        {
+            lua_rawgeti(L, idx, j + 1);
+            ecs_lua_check_primitive(L, -1, t->primitive, ECS_OFFSET(base, j * stride));
+            lua_pop(L, 1);
+        }
+
+        lua_pop(L, 1); /* plan */
+        return;
+    }
+
     for(j=0; j < count; j++)
     {
-        meta_reset(c, (char*)base + j * stride);
+        void *ptr = ECS_OFFSET(base, j * stride);
 
         lua_rawgeti(L, idx, j + 1); /* columns[i+1][j+1] */
-        deserialize_type(L, -1, c);
+
+        if(c)
+        {
+            meta_reset(c, ptr);
+            deserialize_type(L, -1, c);
+        }
+        else ecs_lua_deserialize_op(world, L, -1, ops, op_count, 1, ptr, plan);
 
         lua_pop(L, 1);
     }
+
+    lua_pop(L, 1); /* plan */
 }
 
 void ecs_ptr_to_lua(
@@ -838,7 +1658,16 @@ void ecs_ptr_to_lua(
     ecs_entity_t type,
     const void *ptr)
 {
-    const EcsMetaTypeSerializer *ser = get_serializer(L, world, type);
+    ecs_lua_type_t *t = get_type(L, world, type, false);
+
+    if(t->primitive >= 0)
+    {
+        ecs_lua_push_primitive(L, t->primitive, ptr);
+        return;
+    }
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_assert(ser != NULL, ECS_INTERNAL_ERROR, NULL);
 
     serialize_type(world, ser->ops, ptr, L);
 }
@@ -850,9 +1679,34 @@ void ecs_lua_to_ptr(
     ecs_entity_t type,
     void *ptr)
 {
-    ecs_meta_cursor_t *c = ecs_lua_cursor(L, world, type, ptr);
+    idx = lua_absindex(L, idx);
+
+    ecs_lua_type_t *t = get_type(L, world, type, true);
+
+    if(t->primitive >= 0)
+    {
+        lua_pop(L, 1); /* plan */
+
+        ecs_lua_check_primitive(L, idx, t->primitive, ptr);
+        return;
+    }
+
+    if(t->use_cursor)
+    {
+        lua_pop(L, 1); /* plan */
+
+        ecs_meta_cursor_t *c = ecs_lua_cursor(L, world, type, ptr);
+
+        deserialize_type(L, idx, c);
+        return;
+    }
+
+    const EcsMetaTypeSerializer *ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+    ecs_type_op_t *ops = ecs_vector_first(ser->ops, ecs_type_op_t);
+
+    ecs_lua_deserialize_op(world, L, idx, ops, ecs_vector_count(ser->ops), 1, ptr, lua_gettop(L));
 
-    deserialize_type(L, idx, c);
+    lua_pop(L, 1); /* plan */
 }
 
 void ecs_lua_type_update(
@@ -862,32 +1716,141 @@ void ecs_lua_type_update(
     ecs_entity_t type,
     void *ptr)
 {
-    const EcsMetaTypeSerializer *ser = get_serializer(L, world, type);
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, world, type);
 
     update_type(world, ser->ops, ptr, L, idx);
 }
 
-ecs_iter_t *ecs_iter_to_lua(ecs_iter_t *it, lua_State *L, bool copy)
+ecs_iter_t *ecs_lua_iter_push(lua_State *L, ecs_iter_t *it, bool copy, int flags, uint64_t readonly)
 {
     /* it */
     lua_createtable(L, 0, 16);
 
     /* metatable.__ecs_iter */
-    it = push_iter_metafield(L, it, copy);
+    it = push_iter_metafield(L, it, copy, readonly);
 
     push_iter_metadata(L, it);
-    push_columns(L, it);
+    push_columns(L, it, flags, readonly);
 
     return it;
 }
 
-ecs_iter_t *ecs_lua_to_iter(lua_State *L, int idx)
+/* Points the closure upvalue at the given index to it */
+static void set_iter_upvalue(lua_State *L, int idx, const char *field, ecs_iter_t *it)
+{
+    lua_getfield(L, idx, field);
+    lua_pushlightuserdata(L, it);
+    lua_setupvalue(L, -2, 1);
+    lua_pop(L, 1);
+}
+
+/* Refills the callback's iterator table at the stack top, every field is
+   rewritten since the callback may have assigned it. The entities and
+   columns tables are kept in the metatable in case they were replaced.
+   Returns false if the metatable was replaced and the table must be rebuilt */
+static bool iter_refill(lua_State *L, ecs_iter_t *it)
+{
+    int it_idx = lua_gettop(L);
+
+    if(!lua_getmetatable(L, it_idx)) return false;
+
+    int mt = it_idx + 1;
+
+    if(lua_getfield(L, mt, "__ecs_columns") != LUA_TTABLE)
+    {
+        lua_settop(L, it_idx);
+        return false;
+    }
+
+    int columns = it_idx + 2;
+
+    lua_getfield(L, mt, "__ecs_entities");
+
+    int entities = it_idx + 3;
+
+    lua_pushlightuserdata(L, it);
+    lua_setfield(L, mt, "__ecs_iter");
+
+    lua_getmetatable(L, entities);
+    lua_pushlightuserdata(L, it);
+    lua_setfield(L, -2, "__ecs_iter");
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, entities);
+    lua_setfield(L, it_idx, "entities");
+
+    int i;
+    for(i=1; i <= it->column_count; i++)
+    {
+        lua_pushnil(L);
+        lua_rawseti(L, columns, i);
+    }
+
+    lua_getmetatable(L, columns);
+    set_iter_upvalue(L, -1, "__index", it);
+    set_iter_upvalue(L, -1, "__len", it);
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, columns);
+    lua_setfield(L, it_idx, "columns");
+
+    lua_settop(L, it_idx);
+
+    push_iter_fields(L, it);
+
+    return true;
+}
+
+/* The tables are also kept in the metatable of the iterator table at the stack top */
+static void keep_iter_tables(lua_State *L)
+{
+    lua_getmetatable(L, -1);
+
+    lua_getfield(L, -2, "entities");
+    lua_setfield(L, -2, "__ecs_entities");
+
+    lua_getfield(L, -2, "columns");
+    lua_setfield(L, -2, "__ecs_columns");
+
+    lua_pop(L, 1);
+}
+
+ecs_iter_t *ecs_lua_callback_iter(lua_State *L, ecs_iter_t *it, ecs_lua_callback *cb, ecs_lua_callback_state *state)
+{
+    if(state->it_ref != LUA_NOREF)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, state->it_ref);
+
+        if(iter_refill(L, it)) return it;
+
+        lua_pop(L, 1);
+        luaL_unref(L, LUA_REGISTRYINDEX, state->it_ref);
+    }
+
+    lua_createtable(L, 0, 16);
+
+    push_iter_metafield(L, it, false, cb->readonly);
+    push_iter_metadata(L, it);
+    push_columns_table(L, it, cb->flags, cb->readonly);
+    keep_iter_tables(L);
+
+    lua_pushvalue(L, -1);
+    state->it_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    return it;
+}
+
+ecs_iter_t *ecs_iter_to_lua(ecs_iter_t *it, lua_State *L, bool copy)
+{
+    return ecs_lua_iter_push(L, it, copy, 0, 0);
+}
+
+ecs_iter_t *ecs_lua_iter_readback(lua_State *L, int idx, ecs_lua_ctx *ctx)
 {
     ecs_lua_dbg("ECS_LUA_TO_ITER");
     ecs_lua__prolog(L);
     ecs_iter_t *it = ecs_lua__checkiter(L, idx);
     ecs_world_t *world = it->world;
-    const ecs_world_t *real_world = ecs_get_world(world);
 
     if(lua_getfield(L, idx, "interrupted_by") == LUA_TNUMBER) it->interrupted_by = lua_tointeger(L, -1);
 
@@ -896,16 +1859,17 @@ ecs_iter_t *ecs_lua_to_iter(lua_State *L, int idx)
     /* newly-returned iterators have it->count = 0 */
     if(!it->count) return it;
 
+    uint64_t readonly = iter_readonly(L, idx);
+
     luaL_getsubtable(L, idx, "columns");
     luaL_checktype(L, -1, LUA_TTABLE);
 
     int32_t i;
     for(i=1; i <= it->column_count; i++)
     {
-        if(it->query && ecs_term_is_readonly(it, i)) continue;
-
         int type = lua_rawgeti(L, -1, i); /* columns[i] */
         bool is_owned = ecs_term_is_owned(it, i);
+        int32_t count = is_owned ? it->count : 1;
 
         if(type == LUA_TNIL)
         {
@@ -914,15 +1878,36 @@ ecs_iter_t *ecs_lua_to_iter(lua_State *L, int idx)
             continue;
         }
 
+        /* Proxies were written in place */
+        if(type == LUA_TUSERDATA) ecs_lua_invalidate_proxy(L, -1);
+
+        if(type == LUA_TUSERDATA || is_readonly(it, i, readonly))
+        {
+            ctx->rows_skipped += count;
+            lua_pop(L, 1);
+            continue;
+        }
+
+        int32_t written = ecs_lua_tracked_readback(L, -1);
+
+        if(written >= 0)
+        {
+            ctx->rows_written += written;
+            ctx->rows_skipped += count - written;
+            lua_pop(L, 1);
+            continue;
+        }
+
         if(is_owned) { ecs_assert(it->count == lua_rawlen(L, -1), ECS_INTERNAL_ERROR, NULL); }
 
-        int32_t count = it->count;
         ecs_entity_t column_entity = ecs_get_typeid(world, ecs_term_id(it, i));
         void *base = ecs_term_w_size(it, 0, i);
 
         if(!is_owned) ecs_lua_to_ptr(world, L, -1, column_entity, base);
         else deserialize_column(world, L, -1, column_entity, base, ecs_term_size(it, i), count);
 
+        ctx->rows_written += count;
+
         lua_pop(L, 1); /* columns[i] */
     }
 
@@ -933,8 +1918,33 @@ ecs_iter_t *ecs_lua_to_iter(lua_State *L, int idx)
     return it;
 }
 
+void ecs_lua_iter_invalidate(lua_State *L, int idx)
+{
+    if(lua_getfield(L, idx, "columns") == LUA_TTABLE)
+    {
+        lua_pushnil(L);
+
+        while(lua_next(L, -2))
+        {
+            ecs_lua_invalidate_proxy(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+
+    lua_pop(L, 1);
+}
+
+ecs_iter_t *ecs_lua_to_iter(lua_State *L, int idx)
+{
+    ecs_iter_t *it = ecs_lua__checkiter(L, idx);
+
+    return ecs_lua_iter_readback(L, idx, ecs_lua_get_context(L, ecs_get_world(it->world)));
+}
+
 void ecs_lua_iter_update(lua_State *L, int idx, ecs_iter_t *it)
 {
+    uint64_t readonly = iter_readonly(L, idx);
+
     lua_pushvalue(L, idx);
 
     push_iter_metadata(L, it);
@@ -942,7 +1952,7 @@ void ecs_lua_iter_update(lua_State *L, int idx, ecs_iter_t *it)
     lua_pushnil(L);
     lua_setfield(L, -2, "columns");
 
-    push_columns(L, it);
+    push_columns(L, it, 0, readonly);
 
     lua_pop(L, 1);
 }
@@ -974,7 +1984,7 @@ int meta_constants(lua_State *L)
     if(!meta) luaL_argerror(L, 1, "invalid type");
     if(meta->kind != EcsEnumType && meta->kind != EcsBitmaskType) luaL_argerror(L, 1, "not an enum/bitmask");
 
-    const EcsMetaTypeSerializer *ser = get_serializer(L, w, type);
+    const EcsMetaTypeSerializer *ser = ecs_lua_get_serializer(L, w, type);
     ecs_type_op_t *op = (ecs_type_op_t*)ecs_vector_get(ser->ops, ecs_type_op_t, 1);
 
     if(lua_type(L, 2) == LUA_TTABLE) lua_pushvalue(L, 2);
@@ -985,7 +1995,8 @@ int meta_constants(lua_State *L)
     return 1;
 }
 
-static void each_reset_columns(lua_State *L, ecs_lua_each_t *each)
+/* Plans are kept in the uservalue of the each userdata */
+static void each_reset_columns(lua_State *L, ecs_lua_each_t *each, int idx)
 {
     ecs_iter_t *it = each->it;
     ecs_lua_col_t *col = each->cols;
@@ -998,22 +2009,33 @@ static void each_reset_columns(lua_State *L, ecs_lua_each_t *each)
         return;
     }
 
+    idx = lua_absindex(L, idx);
+
+    lua_createtable(L, it->column_count, 0);
+
     int i;
     for(i=1; i <= it->column_count; i++, col++)
     {
         col->type = ecs_get_typeid(world, ecs_term_id(it, i));
         col->stride = ecs_term_size(it, i);
         col->ptr = ecs_term_w_size(it, 0, i);
-        col->ser = get_serializer(L, world, col->type);
-        col->cursor = ecs_lua_cursor(L, it->world, col->type, col->ptr);
+
+        ecs_lua_type_t *t = get_type(L, world, col->type, true);
+        lua_rawseti(L, -2, i);
+
+        col->ser = ecs_get_ref_w_id(ecs_get_world(world), &t->ref, 0, 0);
+        col->cursor = t->use_cursor ? ecs_lua_cursor(L, it->world, col->type, col->ptr) : NULL;
+        col->primitive = t->primitive;
 
         if(!ecs_term_is_owned(it, i)) col->stride = 0;
 
-        if(it->query && ecs_term_is_readonly(it, i)) col->readback = false;
-        else col->readback = true;
+        /* Bare values are copies, there is nothing to read back */
+        col->readback = t->primitive < 0 && !is_readonly(it, i, each->readonly);
 
         col->update = true;
     }
+
+    lua_setuservalue(L, idx);
 }
 
 static int next_func(lua_State *L)
@@ -1029,6 +2051,8 @@ static int next_func(lua_State *L)
 
     if(!each->read_prev) goto skip_readback;
 
+    lua_getuservalue(L, lua_upvalueindex(1)); /* plans */
+
     for(j=0; j < it->column_count; j++, col++)
     {
         if(!col->readback) continue;
@@ -1038,10 +2062,23 @@ static int next_func(lua_State *L)
         idx = lua_upvalueindex(j+2);
         ptr = ECS_OFFSET(col->ptr, col->stride * (i - 1));
 
-        meta_reset(col->cursor, ptr);
-        deserialize_type(L, idx, col->cursor);
+        if(col->cursor)
+        {
+            meta_reset(col->cursor, ptr);
+            deserialize_type(L, idx, col->cursor);
+            continue;
+        }
+
+        ecs_type_op_t *ops = ecs_vector_first(col->ser->ops, ecs_type_op_t);
+        int32_t count = ecs_vector_count(col->ser->ops);
+
+        lua_rawgeti(L, -1, j + 1);
+        ecs_lua_deserialize_op(it->world, L, idx, ops, count, 1, ptr, lua_gettop(L));
+        lua_pop(L, 1);
     }
 
+    lua_pop(L, 1); /* plans */
+
     col = each->cols;
 
 skip_readback:
@@ -1052,13 +2089,17 @@ skip_readback:
     {
         if(each->from_query)
         {
-            if(ecs_lua_query_next(L, 1)) each_reset_columns(L, each);
+            if(ecs_lua_query_next(L, 1)) each_reset_columns(L, each, lua_upvalueindex(1));
             else end = true;
         }
         else end = true;
     }
 
-    if(end) return 0;
+    if(end)
+    {/* No current row for it:getm()/it:setm() */
+        each->read_prev = false;
+        return 0;
+    }
 
     for(j=0; j < it->column_count; j++, col++)
     {// optimization: shared components should be read back at the end
@@ -1067,6 +2108,12 @@ skip_readback:
         idx = lua_upvalueindex(j+2);
         ptr = ECS_OFFSET(col->ptr, col->stride * i);
 
+        if(col->primitive >= 0)
+        {
+            ecs_lua_push_primitive(L, col->primitive, ptr);
+            continue;
+        }
+
         lua_pushvalue(L, idx);
         update_type(each->it->real_world, col->ser->ops, ptr, L, idx);
     }
@@ -1078,18 +2125,28 @@ skip_readback:
     return it->column_count + 1;
 }
 
-static int is_primitive(const EcsMetaTypeSerializer *ser)
+int32_t ecs_lua_each_row(lua_State *L, int idx, ecs_iter_t *it, int32_t term)
 {
-    ecs_assert(ser != NULL, ECS_INVALID_PARAMETER, NULL);
+    if(lua_getfield(L, idx, "__each") != LUA_TFUNCTION)
+    {
+        lua_pop(L, 1);
+        return 0;
+    }
 
-    ecs_type_op_t *ops = (ecs_type_op_t*)ecs_vector_first(ser->ops, ecs_type_op_t);
-    int32_t count = ecs_vector_count(ser->ops);
+    lua_getupvalue(L, -1, 1);
+    ecs_lua_each_t *each = lua_touserdata(L, -1);
+    lua_pop(L, 1);
 
-    if(count != 2) return 0;
+    if(each->it != it || !each->read_prev || each->i < 1 || each->i > it->count)
+    {
+        lua_pop(L, 1);
+        return 0;
+    }
 
-    if(ops[1].kind = EcsOpPrimitive) return 1;
+    lua_getupvalue(L, -1, term + 1);
+    lua_remove(L, -2);
 
-    return 0;
+    return each->i;
 }
 
 int each_func(lua_State *L)
@@ -1115,23 +2172,23 @@ int each_func(lua_State *L)
     each->it = it;
     each->from_query = q ? true : false;
     each->read_prev = false;
+    each->readonly = iter_readonly(L, iter_idx);
 
-    each_reset_columns(L, each);
+    each_reset_columns(L, each, -1);
 
     int i;
     for(i=1; i <= it->column_count; i++)
     {
         lua_newtable(L);
-
-        //if(!it->is_valid) continue;
-
-        const EcsMetaTypeSerializer *ser = each->cols[i].ser;
-        //if(!ser) luaL_error(L, "col");
-        //if(is_primitive(ser)) luaL_error(L, "primitive");
     }
 
     lua_pushcclosure(L, next_func, it->column_count + 1);
 
+    /* Current row for it:getm()/it:setm() */
+    lua_pushliteral(L, "__each");
+    lua_pushvalue(L, -2);
+    lua_rawset(L, iter_idx);
+
     /* it */
     lua_pushvalue(L, iter_idx);
 
@@ -8,6 +8,101 @@ ecs_type_t checktype(lua_State *L, int arg)
     return *type;
 }
 
+/* Entry in the ECS_LUA_EXPRS cache */
+typedef struct ecs_lua_type_expr
+{
+    ecs_type_t type;
+    ecs_entity_t scope;
+    int32_t names; /* ctx->names when the expression was resolved */
+}ecs_lua_type_expr;
+
+static void names_changed(ecs_iter_t *it)
+{
+    ecs_lua_ctx *ctx = it->ctx;
+
+    ctx->names++;
+}
+
+/* The trigger points into the state, it must not outlive the context */
+void ecs_lua_track_names(ecs_world_t *w, ecs_lua_ctx *ctx)
+{
+    if(ctx->names_trigger) return;
+
+    ctx->names_trigger = ecs_trigger_init(w, &(ecs_trigger_desc_t)
+    {
+        .term.id = ecs_pair(ecs_id(EcsIdentifier), EcsName),
+        .events = { EcsOnSet, EcsOnRemove },
+        .callback = names_changed,
+        .ctx = ctx
+    });
+}
+
+void ecs_lua_untrack_names(ecs_lua_ctx *ctx)
+{
+    if(ctx->names_trigger && ecs_is_alive(ctx->world, ctx->names_trigger))
+    {
+        ecs_delete(ctx->world, ctx->names_trigger);
+    }
+
+    ctx->names_trigger = 0;
+}
+
+ecs_type_t ecs_lua_type_from_str(lua_State *L, ecs_world_t *w, int arg)
+{
+    const char *expr = luaL_checkstring(L, arg);
+
+    arg = lua_absindex(L, arg);
+    w = (ecs_world_t*)ecs_get_world(w);
+
+    int ret = lua_rawgetp(L, LUA_REGISTRYINDEX, w);
+    ecs_assert(ret == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
+
+    lua_rawgeti(L, -1, ECS_LUA_CONTEXT);
+    ecs_lua_ctx *ctx = lua_touserdata(L, -1);
+
+    /* Names are only tracked for the main state */
+    if(ctx->stage)
+    {
+        lua_pop(L, 2);
+        return ecs_type_from_str(w, expr);
+    }
+
+    lua_rawgeti(L, -2, ECS_LUA_EXPRS);
+    ecs_entity_t scope = ecs_get_scope(w);
+
+    ecs_lua_type_expr *entry = NULL;
+
+    /* Strings are interned, the lookup does not hash the expression */
+    if(lua_pushvalue(L, arg), lua_rawget(L, -2) == LUA_TUSERDATA)
+    {
+        entry = lua_touserdata(L, -1);
+
+        if(entry->names == ctx->names && entry->scope == scope)
+        {
+            lua_pop(L, 4);
+            return entry->type;
+        }
+    }
+
+    ecs_type_t type = ecs_type_from_str(w, expr);
+
+    if(type)
+    {
+        if(entry == NULL)
+        {
+            lua_pushvalue(L, arg);
+            entry = lua_newuserdata(L, sizeof(ecs_lua_type_expr));
+            lua_rawset(L, -4);
+        }
+
+        *entry = (ecs_lua_type_expr){ .type = type, .scope = scope, .names = ctx->names };
+    }
+
+    lua_pop(L, 4);
+
+    return type;
+}
+
 int check_filter_desc(lua_State *L, const ecs_world_t *world, ecs_filter_desc_t *desc, int arg)
 {
     luaL_checktype(L, arg, LUA_TTABLE);
@@ -70,19 +165,62 @@ int check_filter_desc(lua_State *L, const ecs_world_t *world, ecs_filter_desc_t
     return 0;
 }
 
-int checkfilter(lua_State *L, const ecs_world_t *world, ecs_filter_t *filter, int arg)
+ecs_filter_t *checkfilter(lua_State *L, const ecs_world_t *world, ecs_filter_t *filter, int arg)
 {
+    ecs_lua_filter *compiled = luaL_testudata(L, arg, "ecs_compiled_filter_t");
+
+    if(compiled)
+    {
+        if(!compiled->init) luaL_argerror(L, arg, "filter was collected");
+
+        return &compiled->filter;
+    }
+
     memset(filter, 0, sizeof(ecs_filter_t));
 
     ecs_filter_desc_t filter_desc = {0};
 
     check_filter_desc(L, world, &filter_desc, arg);
 
-    if(ecs_filter_init(world, filter, &filter_desc)) return luaL_argerror(L, arg, "invalid filter");
+    if(ecs_filter_init(world, filter, &filter_desc)) luaL_argerror(L, arg, "invalid filter");
+
+    return filter;
+}
+
+int filter_gc(lua_State *L)
+{
+    ecs_lua_filter *compiled = luaL_checkudata(L, 1, "ecs_compiled_filter_t");
+
+    if(compiled->init) ecs_filter_fini(&compiled->filter);
+
+    compiled->init = false;
 
     return 0;
 }
 
+int filter_new(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+
+    ecs_filter_desc_t desc = {0};
+
+    if(lua_type(L, 1) == LUA_TSTRING) desc.expr = luaL_checkstring(L, 1);
+    else check_filter_desc(L, w, &desc, 1);
+
+    ecs_lua_filter *compiled = lua_newuserdata(L, sizeof(ecs_lua_filter));
+    compiled->init = false;
+
+    luaL_setmetatable(L, "ecs_compiled_filter_t");
+
+    if(ecs_filter_init(w, &compiled->filter, &desc)) return luaL_argerror(L, 1, "invalid filter");
+
+    compiled->init = true;
+
+    register_collectible(L, w, -1);
+
+    return 1;
+}
+
 int assert_func(lua_State *L)
 {
     if(lua_toboolean(L, 1)) return lua_gettop(L);
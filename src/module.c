@@ -30,7 +30,12 @@ static void import_entry_point(ecs_world_t *w)
 
     ecs_set_scope(w, e);
 
+    ecs_entity_t prev_owner = ctx->owner;
+    ctx->owner = e;
+
     ctx->error = lua_pcall(L, 0, 0, 0);
+
+    ctx->owner = prev_owner;
 }
 
 static void export_handles(lua_State *L, int idx, ecs_world_t *w, ecs_entity_t e)
@@ -39,7 +44,9 @@ static void export_handles(lua_State *L, int idx, ecs_world_t *w, ecs_entity_t e
 
     luaL_checktype(L, idx, LUA_TTABLE);
 
-    ecs_type_t name_type = ecs_type_from_str(w, "(Identifier, Name)");
+    lua_pushliteral(L, "(Identifier, Name)");
+    ecs_type_t name_type = ecs_lua_type_from_str(L, w, -1);
+    lua_pop(L, 1);
 
     ecs_filter_t filter = { .include = name_type };
     ecs_iter_t it = ecs_scope_iter_w_filter(w, e, &filter);
@@ -58,8 +58,17 @@ int progress(lua_State *L)
 
     lua_Number delta_time = luaL_checknumber(L, 1);
 
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+    int64_t start = ecs_lua_time_ns();
+
     int b = ecs_progress(w, delta_time);
 
+    /* Worlds without a host state have no frame systems to record it */
+    if(ctx->trace && !ecs_lua_trace_frames(w, ctx))
+    {
+        ecs_lua_trace_record(ctx->trace, 0, EcsLuaTraceFrame, 0, start, ecs_lua_time_ns() - start);
+    }
+
     lua_pushboolean(L, b);
 
     return 1;
@@ -16,6 +16,7 @@ ECS_COMPONENT_EXTERN(EcsLuaWorldInfo);
 ECS_COMPONENT_EXTERN(EcsLuaGauge);
 ECS_COMPONENT_EXTERN(EcsLuaCounter);
 ECS_COMPONENT_EXTERN(EcsLuaWorldStats);
+ECS_COMPONENT_EXTERN(EcsLuaSystemStats);
 ECS_COMPONENT_EXTERN(EcsLuaTermSet);
 ECS_COMPONENT_EXTERN(EcsLuaTermID);
 ECS_COMPONENT_EXTERN(EcsLuaTerm);
@@ -26,6 +27,10 @@ ECS_COMPONENT_EXTERN(EcsLuaTerm);
 #define ECS_LUA_COLLECT    (4)
 #define ECS_LUA_REGISTRY   (5)
 #define ECS_LUA_APIWORLD   (6)
+#define ECS_LUA_DEFER      (7)
+#define ECS_LUA_EXPRS      (8)
+#define ECS_LUA_TRACE      (9)
+#define ECS_LUA_PROFILER   (10)
 
 /* Internal version for API functions */
 static inline ecs_world_t *ecs_lua_world(lua_State *L)
@@ -98,21 +103,207 @@ int ecs_lua_rawgeti(lua_State *L, ecs_world_t *world, int ref);
 /* Releases the reference ref from the registry for the given world  */
 void ecs_lua_unref(lua_State *L, ecs_world_t *world, int ref);
 
+/* Returns the context if structural changes from Lua are queued */
+ecs_lua_ctx *ecs_lua_deferred(lua_State *L, ecs_world_t *w);
+
+void ecs_lua_defer_add(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id);
+void ecs_lua_defer_remove(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id);
+void ecs_lua_defer_type(ecs_lua_ctx *ctx, ecs_entity_t e, ecs_type_t type, bool add);
+void ecs_lua_defer_delete(ecs_lua_ctx *ctx, ecs_entity_t e);
+void ecs_lua_defer_set(lua_State *L, ecs_lua_ctx *ctx, ecs_entity_t e, ecs_id_t id, int arg);
+
+typedef struct ecs_lua_trace ecs_lua_trace;
+typedef struct ecs_lua_profiler ecs_lua_profiler;
+
+typedef enum ecs_lua_trace_kind
+{
+    EcsLuaTraceFrame = 0,
+    EcsLuaTraceProgress,
+    EcsLuaTraceSystem, /* + EcsLuaCallbackType */
+    EcsLuaTraceTrigger,
+    EcsLuaTraceObserver,
+    EcsLuaTraceSerialize,
+    EcsLuaTraceCall,
+    EcsLuaTraceReadback
+}ecs_lua_trace_kind;
+
+static inline int64_t ecs_lua_time_ns(void)
+{
+    ecs_time_t t;
+    ecs_os_get_time(&t);
+
+    return (int64_t)t.sec * 1000000000 + t.nanosec;
+}
+
+/* Records an event into the ring of the stage if ecs.trace_begin() is active */
+void ecs_lua_trace_record(ecs_lua_trace *trace, int32_t stage, int32_t kind, ecs_entity_t e, int64_t ts, int64_t dur);
+
+/* PreFrame/PostFrame systems that record frames for the host state */
+void ecs_lua__trace_frame_begin(ecs_iter_t *it);
+void ecs_lua__trace_frame_end(ecs_iter_t *it);
+
+/* True if the frame systems record frames for ctx */
+bool ecs_lua_trace_frames(const ecs_world_t *world, ecs_lua_ctx *ctx);
+
+/* True if the system was created by ecs.kernel() */
+bool ecs_lua_is_kernel(const ecs_world_t *world, ecs_entity_t system);
+
+/* Stops the ecs.async() worker pool, pending jobs are either cancelled or finished */
+void ecs_lua_async_fini(ecs_lua_ctx *ctx, bool cancel);
+
+/* Default allocator, ud is an ecs_lua_alloc or NULL to skip the accounting */
+void *ecs_lua_allocf(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/* Small blocks come from size-class slabs if pool is set */
+struct ecs_lua_alloc *ecs_lua_alloc_new(bool pool);
+
+/* Bytes ever allocated */
+int64_t ecs_lua_alloc_total(const struct ecs_lua_alloc *a);
+
+/* Built-in allocator for a worker state created from L, with its own counters
+   if track is set. The allocator of L is not shared: neither host allocators
+   nor counters are expected to be thread-safe */
+lua_Alloc ecs_lua_get_allocf(lua_State *L, void **ud, bool track);
+
+/* Attributes allocations of the state to ctx->owner */
+void ecs_lua_alloc_bind(ecs_lua_ctx *ctx);
+
+/* lua_close() that also frees the counters of the state */
+void ecs_lua_close(lua_State *L);
+
+typedef struct ecs_lua_memory_totals
+{
+    int64_t bytes;
+    int64_t peak;
+    int64_t count;
+    int64_t total;
+    int64_t pool; /* Bytes held by slabs */
+}ecs_lua_memory_totals;
+
+/* Sums the main state of the world and its worker stage states */
+void ecs_lua_memory_get_totals(lua_State *L, ecs_world_t *w, ecs_lua_memory_totals *totals);
+
+/* ecs.member() handle, the member path is the uservalue */
+typedef struct ecs_lua_member
+{
+    ecs_entity_t component;
+    int32_t offset;
+    ecs_type_op_kind_t kind; /* EcsOpPrimitive, EcsOpEnum, EcsOpBitmask */
+    ecs_primitive_kind_t primitive;
+}ecs_lua_member;
+
+/* Pushes/checks the value of a member handle at base (the component pointer) */
+void ecs_lua_push_member(lua_State *L, const ecs_lua_member *m, const void *base);
+void ecs_lua_check_member(lua_State *L, int arg, const ecs_lua_member *m, void *base);
+
+/* Assigns the value at idx to rows[row].path of the serialized column at the stack top */
+void ecs_lua_sync_row(lua_State *L, int idx, int32_t row, const char *path);
+
+/* Sets the member at path of the table on top of the stack to the value at idx, pops the table */
+void ecs_lua_sync_member(lua_State *L, int idx, const char *path);
+
+/* Returns the current row of an ecs.each() loop over the iterator at idx and pushes
+   the table it yielded for the term, returns 0 and pushes nothing outside of a loop */
+int32_t ecs_lua_each_row(lua_State *L, int idx, ecs_iter_t *it, int32_t term);
+
 /* meta */
 bool ecs_lua_query_next(lua_State *L, int idx);
 int meta_constants(lua_State *L);
 
+const EcsMetaTypeSerializer *ecs_lua_get_serializer(lua_State *L, const ecs_world_t *world, ecs_entity_t type);
+void ecs_lua_push_primitive(lua_State *L, ecs_primitive_kind_t kind, const void *base);
+void ecs_lua_check_primitive(lua_State *L, int arg, ecs_primitive_kind_t kind, void *base);
+
+/* Types with a single primitive op are pushed and read as bare values */
+bool ecs_lua_is_primitive(const EcsMetaTypeSerializer *ser);
+
+/* Pushes the value of a single (non-scope) op */
+void ecs_lua_serialize_op(const ecs_world_t *world, lua_State *L, ecs_type_op_t *op, const void *base);
+
+/* Pushes the table for the scope ops[scope] (EcsOpPush) */
+void ecs_lua_serialize_scope(const ecs_world_t *world, lua_State *L, ecs_type_op_t *ops, int32_t scope, const void *base);
+
+/* Pushes the field lookup plan for the type and returns its serializer,
+   use_cursor (optional) is set if the type has members the plan cannot write */
+const EcsMetaTypeSerializer *ecs_lua_push_plan(lua_State *L, const ecs_world_t *world, ecs_entity_t type, bool *use_cursor);
+
+/* Writes the value at arg to ops[index], nested scopes expect tables */
+void ecs_lua_deserialize_op(const ecs_world_t *world, lua_State *L, int arg, ecs_type_op_t *ops, int32_t count, int32_t index, void *base, int plan);
+
+/* Userdata of ecs.filter(), the filter may point into itself */
+typedef struct ecs_lua_filter
+{
+    ecs_filter_t filter;
+    bool init;
+}ecs_lua_filter;
+
+/* Keeps a filter object alive for the iterator at the stack top */
+void ecs_lua_iter_anchor(lua_State *L, int arg);
+
+/* Userdata of ecs.bulk_new(..., "range") */
+typedef struct ecs_lua_range
+{
+    int32_t count;
+    ecs_entity_t entities[];
+}ecs_lua_range;
+
+/* Returns the op for a member path ("a.b.c") of a struct, or NULL */
+ecs_type_op_t *ecs_lua_member_op(ecs_type_op_t *ops, int32_t count, const char *path);
+
+/* Returns the op index for the key at the given index in the scope ops[scope], or -1 */
+int32_t ecs_lua_find_member(lua_State *L, int plan, int32_t scope, int key);
+
+/* Pushes the iterator, flags are ecs_lua_callback flags,
+   readonly is a bitmask of terms that are never written back */
+ecs_iter_t *ecs_lua_iter_push(lua_State *L, ecs_iter_t *it, bool copy, int flags, uint64_t readonly);
+
+struct ecs_lua_callback;
+struct ecs_lua_callback_state;
+
+/* Pushes the iterator table of the callback in the given state,
+   created on first use and refilled in place afterwards */
+ecs_iter_t *ecs_lua_callback_iter(lua_State *L, ecs_iter_t *it, struct ecs_lua_callback *cb, struct ecs_lua_callback_state *state);
+
+/* ecs_lua_to_iter() with the world context resolved by the caller */
+ecs_iter_t *ecs_lua_iter_readback(lua_State *L, int idx, ecs_lua_ctx *ctx);
+
+/* Whether term i of the iterator table at idx is [in] or otherwise readonly,
+   checked for all kinds of iterators */
+bool ecs_lua_term_readonly(lua_State *L, int idx, ecs_iter_t *it, int32_t i);
+
 /* Update iterator, usually called after ecs_lua_to_iter() + ecs_*_next() */
 void ecs_lua_iter_update(lua_State *L, int idx, ecs_iter_t *it);
 
+/* column */
+void ecs_lua_push_proxy(lua_State *L, ecs_iter_t *it, int32_t i, ecs_entity_t type, bool readonly);
+void ecs_lua_invalidate_proxy(lua_State *L, int idx);
+
+/* Invalidates the proxies and tracked columns of an iterator that is not read back */
+void ecs_lua_iter_invalidate(lua_State *L, int idx);
+
+/* Pushes a write-tracking column, returns false (and pushes nothing)
+   if the type cannot be tracked */
+bool ecs_lua_push_tracked(lua_State *L, ecs_iter_t *it, int32_t i, ecs_entity_t type);
+
+/* Writes back modified rows of a tracked column and returns their count,
+   or -1 if the value at idx is not a tracked column */
+int32_t ecs_lua_tracked_readback(lua_State *L, int idx);
+
 /* iter */
 ecs_iter_t *ecs_lua__checkiter(lua_State *L, int idx);
 ecs_term_t checkterm(lua_State *L, const ecs_world_t *world, int arg);
 
 /* misc */
 ecs_type_t checktype(lua_State *L, int arg);
+
+/* Returns the type for the expression at arg, cached until entity names or the scope change */
+ecs_type_t ecs_lua_type_from_str(lua_State *L, ecs_world_t *w, int arg);
+void ecs_lua_track_names(ecs_world_t *w, ecs_lua_ctx *ctx);
+void ecs_lua_untrack_names(ecs_lua_ctx *ctx);
 int check_filter_desc(lua_State *L, const ecs_world_t *world, ecs_filter_desc_t *desc, int arg);
-int checkfilter(lua_State *L, const ecs_world_t *world, ecs_filter_t *filter, int arg);
+/* Returns the ecs.filter() object at arg or initializes filter from a descriptor,
+   the filter has to be finalized only if the returned pointer is filter */
+ecs_filter_t *checkfilter(lua_State *L, const ecs_world_t *world, ecs_filter_t *filter, int arg);
 ecs_query_t *checkquery(lua_State *L, int arg);
 int ecs_lua__readonly(lua_State *L);
 void ecs_lua__assert(lua_State *L, bool condition, const char *param, const char *condition_str);
@@ -123,6 +314,10 @@ void ecs_lua__assert(lua_State *L, bool condition, const char *param, const char
     #define ecs_lua_assert(L, condition, param) ecs_lua__assert(L, condition, NULL, #condition)
 #endif
 
+typedef struct ecs_lua_async ecs_lua_async;
+typedef struct ecs_lua_alloc ecs_lua_alloc;
+typedef struct ecs_lua_defer ecs_lua_defer;
+
 typedef struct ecs_lua_ctx
 {
     lua_State *L;
@@ -133,6 +328,29 @@ typedef struct ecs_lua_ctx
     int error;
     int progress_ref;
     int prefix_ref;
+
+    int32_t stage; /* Worker stage of the state, 0 for the main state */
+
+    ecs_lua_async *async; /* ecs.async() worker pool */
+    ecs_lua_defer *defer; /* ecs.defer_begin() command queue */
+    ecs_lua_trace *trace; /* ecs.trace_begin() rings, main state only */
+    ecs_lua_profiler *profiler; /* ecs.profiler_start() samples, main state only */
+    ecs_lua_alloc *alloc; /* Memory accounting, NULL for foreign allocators */
+
+    /* Running Lua system or module, tags profiler samples and allocations */
+    ecs_entity_t owner;
+
+    /* Callback readback totals */
+    int64_t rows_written;
+    int64_t rows_skipped;
+
+    int32_t names; /* Changes of entity names, invalidates cached type expressions */
+    ecs_entity_t names_trigger; /* Deleted before the context is freed */
+
+    /* Command queue totals */
+    int64_t defer_queued;
+    int64_t defer_coalesced;
+    int64_t defer_flushes;
 }ecs_lua_ctx;
 
 typedef enum EcsLuaCallbackType
@@ -142,10 +360,51 @@ typedef enum EcsLuaCallbackType
     EcsLuaObserver
 }EcsLuaCallbackType;
 
+/* ecs_lua_callback flags */
+#define ECS_LUA__PROXY 1 /* Columns are pushed as proxies */
+#define ECS_LUA__TRACK 2 /* Only modified rows are written back */
+#define ECS_LUA__MULTI 4 /* Runs on worker stages */
+
+/* Totals of one stage, reduced into EcsLuaSystemStats every frame */
+typedef struct ecs_lua_callback_stats
+{
+    int64_t invocations;
+    int64_t rows;
+    int64_t serialize_ns;
+    int64_t call_ns;
+    int64_t readback_ns;
+    int64_t alloc_bytes;
+
+    /* Fastest/slowest invocation since the last sample */
+    int64_t min_ns;
+    int64_t max_ns;
+}ecs_lua_callback_stats;
+
+/* Handles of a callback in the state of one stage */
+typedef struct ecs_lua_callback_state
+{
+    lua_State *L; /* NULL if not bound */
+    ecs_lua_ctx *ctx;
+    ecs_world_t **wbuf; /* API world pointer */
+
+    int func_ref; /* LUA_REGISTRYINDEX */
+
+    /* Iterator table reused across invocations (LUA_REGISTRYINDEX),
+       fields added by the callback are kept */
+    int it_ref;
+    bool it_busy;
+
+    ecs_lua_callback_stats stats;
+}ecs_lua_callback_state;
+
 typedef struct ecs_lua_callback
 {
-    int func_ref;
+    ecs_lua_callback_state *states; /* [stage_id], [0] is the main state */
+    int32_t state_count;
+
     int param_ref;
+    int flags;
+    uint64_t readonly; /* [in] terms */
 
     EcsLuaCallbackType type;
     const char *type_name;
@@ -226,6 +485,24 @@ ECS_STRUCT(EcsLuaWorldStats,
     int32_t t;
 });
 
+/* Set on Lua systems, updated at the end of every frame */
+ECS_STRUCT(EcsLuaSystemStats,
+{
+    int64_t invocations;
+    int64_t rows;
+    int64_t serialize_ns;
+    int64_t call_ns;
+    int64_t readback_ns;
+    int64_t alloc_bytes;
+
+    EcsLuaGauge time;
+
+    int32_t t;
+});
+
+/* PostFrame system that samples EcsLuaSystemStats */
+void ecs_lua__system_stats(ecs_iter_t *it);
+
 ECS_STRUCT(EcsLuaTermSet,
 {
     ecs_entity_t relation;
@@ -397,7 +674,8 @@ ECS_STRUCT(EcsLuaTerm,
 \
     XX(LuaGauge) \
     XX(LuaCounter) \
-    XX(LuaWorldStats)
+    XX(LuaWorldStats) \
+    XX(LuaSystemStats)
 
 
 
@@ -0,0 +1,319 @@
+#include "private.h"
+
+#include <stdio.h>
+
+/* ecs.profiler_start() installs a count hook on the main state, every
+   prof->count instructions the hook checks the clock and at most once per
+   period it folds the Lua stack into "system;src:line;..." and counts it.
+   ecs.profiler_stop() returns the folded stacks.
+
+   The count starts from the sample rate and an assumed instruction rate,
+   the hook then doubles or halves it until the clock is checked about
+   ECS_LUA_PROFILER_CHECKS times per period */
+
+#define ECS_LUA_PROFILER_RATE (100000000) /* Assumed instructions per second */
+#define ECS_LUA_PROFILER_CHECKS (8) /* Clock checks per period */
+#define ECS_LUA_PROFILER_MIN_COUNT (100)
+#define ECS_LUA_PROFILER_MAX_COUNT (1000000)
+#define ECS_LUA_PROFILER_DEPTH (64)
+#define ECS_LUA_PROFILER_BUF (4096)
+
+typedef struct ecs_lua_sample
+{
+    char *stack;
+    int64_t count;
+}ecs_lua_sample;
+
+struct ecs_lua_profiler
+{
+    bool enabled;
+    lua_State *L; /* Main thread, hooked */
+    ecs_lua_ctx *ctx;
+
+    int64_t interval; /* ns */
+    int64_t next;
+
+    int count; /* Instructions between clock checks */
+    int64_t last; /* Last clock check */
+
+    int64_t total;
+    ecs_map_t *samples; /* hash of the folded stack, ecs_lua_sample */
+
+    char buf[ECS_LUA_PROFILER_BUF];
+};
+
+/* Lightuserdata key of the active profiler, the hook has no other context */
+static char profiler_key;
+
+static uint64_t hash_stack(const char *str, int32_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    int32_t i;
+    for(i=0; i < len; i++)
+    {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* Appends a frame, ';' and newlines would break the folded format */
+static int32_t append_frame(char *buf, int32_t pos, const char *frame)
+{
+    if(pos) buf[pos++] = ';';
+
+    for(; *frame && pos < ECS_LUA_PROFILER_BUF - 1; frame++)
+    {
+        char c = *frame;
+        buf[pos++] = (c == ';' || c == '\n' || c == '\r') ? '_' : c;
+    }
+
+    return pos < ECS_LUA_PROFILER_BUF - 1 ? pos : ECS_LUA_PROFILER_BUF - 2;
+}
+
+static void add_sample(ecs_lua_profiler *prof, int32_t len)
+{
+    ecs_map_key_t key = hash_stack(prof->buf, len);
+    ecs_lua_sample *s;
+
+    /* Probe past colliding stacks */
+    while((s = ecs_map_get(prof->samples, ecs_lua_sample, key)))
+    {
+        if(!strcmp(s->stack, prof->buf))
+        {
+            s->count++;
+            return;
+        }
+
+        key++;
+    }
+
+    ecs_lua_sample sample = { .stack = ecs_os_strdup(prof->buf), .count = 1 };
+
+    ecs_map_set(prof->samples, key, &sample);
+}
+
+static void take_sample(lua_State *L, ecs_lua_profiler *prof)
+{
+    ecs_lua_ctx *ctx = prof->ctx;
+    const char *name = NULL;
+    char frame[LUA_IDSIZE + 32];
+    lua_Debug ar;
+
+    if(ctx->owner)
+    {
+        name = ecs_get_name(ctx->world, ctx->owner);
+
+        if(name == NULL)
+        {
+            snprintf(frame, sizeof(frame), "#%llu", (unsigned long long)ctx->owner);
+            name = frame;
+        }
+    }
+
+    int32_t pos = append_frame(prof->buf, 0, name ? name : "lua");
+
+    int depth = 0;
+    while(depth < ECS_LUA_PROFILER_DEPTH && lua_getstack(L, depth, &ar)) depth++;
+
+    /* Root to leaf */
+    while(depth--)
+    {
+        lua_getstack(L, depth, &ar);
+        lua_getinfo(L, "Sl", &ar);
+
+        if(ar.currentline < 0) snprintf(frame, sizeof(frame), "[%s]", ar.what);
+        else snprintf(frame, sizeof(frame), "%s:%d", ar.short_src, ar.currentline);
+
+        pos = append_frame(prof->buf, pos, frame);
+    }
+
+    prof->buf[pos] = '\0';
+
+    add_sample(prof, pos);
+
+    prof->total++;
+}
+
+static void profiler_hook(lua_State *L, lua_Debug *ar)
+{
+    (void)ar;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &profiler_key);
+    ecs_lua_profiler *prof = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if(prof == NULL || !prof->enabled) return;
+
+    int64_t now = ecs_lua_time_ns();
+    int64_t check = prof->interval / ECS_LUA_PROFILER_CHECKS;
+    int64_t elapsed = now - prof->last;
+    int count = prof->count;
+
+    prof->last = now;
+
+    if(elapsed < check / 2 && count < ECS_LUA_PROFILER_MAX_COUNT) count *= 2;
+    else if(elapsed > check * 2 && count > ECS_LUA_PROFILER_MIN_COUNT) count /= 2;
+
+    if(count != prof->count)
+    {
+        prof->count = count;
+        lua_sethook(L, profiler_hook, LUA_MASKCOUNT, count);
+
+        /* Threads created afterwards copy the count of the main thread */
+        if(L != prof->L) lua_sethook(prof->L, profiler_hook, LUA_MASKCOUNT, count);
+    }
+
+    if(now < prof->next) return;
+
+    /* Time spent outside of Lua is not made up for */
+    prof->next = now + prof->interval;
+
+    take_sample(L, prof);
+}
+
+static void profiler_clear(ecs_lua_profiler *prof)
+{
+    if(prof->samples == NULL) return;
+
+    ecs_map_iter_t it = ecs_map_iter(prof->samples);
+    ecs_lua_sample *s;
+
+    while((s = ecs_map_next(&it, ecs_lua_sample, NULL))) ecs_os_free(s->stack);
+
+    ecs_map_clear(prof->samples);
+
+    prof->total = 0;
+}
+
+static void profiler_disable(lua_State *L, ecs_lua_profiler *prof)
+{
+    if(!prof->enabled) return;
+
+    lua_sethook(prof->L, NULL, 0, 0);
+
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &profiler_key);
+
+    prof->enabled = false;
+}
+
+static int profiler_gc(lua_State *L)
+{
+    ecs_lua_profiler *prof = lua_touserdata(L, 1);
+
+    profiler_disable(L, prof);
+    profiler_clear(prof);
+
+    ecs_map_free(prof->samples);
+    prof->samples = NULL;
+
+    return 0;
+}
+
+/* Returns registry[world][ECS_LUA_PROFILER], it is created on first use */
+static ecs_lua_profiler *get_profiler(lua_State *L, ecs_lua_ctx *ctx)
+{
+    if(ctx->profiler) return ctx->profiler;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ctx->world);
+
+    ecs_lua_profiler *prof = lua_newuserdata(L, sizeof(ecs_lua_profiler));
+    memset(prof, 0, sizeof(ecs_lua_profiler));
+
+    prof->L = ctx->L;
+    prof->ctx = ctx;
+    prof->samples = ecs_map_new(ecs_lua_sample, 64);
+
+    if(luaL_newmetatable(L, "ecs_profiler_t"))
+    {
+        lua_pushcfunction(L, profiler_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+
+    lua_setmetatable(L, -2);
+
+    lua_rawseti(L, -2, ECS_LUA_PROFILER);
+    lua_pop(L, 1);
+
+    ctx->profiler = prof;
+
+    return prof;
+}
+
+int profiler_start(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    lua_Integer hz = luaL_optinteger(L, 1, 1000);
+
+    if(ctx->stage) return luaL_error(L, "profiling can only be started by the main state");
+    if(hz < 1 || hz > 100000) return luaL_argerror(L, 1, "invalid frequency");
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &profiler_key);
+    ecs_lua_profiler *active = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if(active && active->ctx != ctx) return luaL_error(L, "profiler is running for another world");
+
+    ecs_lua_profiler *prof = get_profiler(L, ctx);
+
+    profiler_clear(prof);
+
+    prof->interval = 1000000000 / hz;
+    prof->next = ecs_lua_time_ns() + prof->interval;
+    prof->last = ecs_lua_time_ns();
+    prof->enabled = true;
+
+    lua_Integer count = ECS_LUA_PROFILER_RATE / hz / ECS_LUA_PROFILER_CHECKS;
+
+    if(count < ECS_LUA_PROFILER_MIN_COUNT) count = ECS_LUA_PROFILER_MIN_COUNT;
+    if(count > ECS_LUA_PROFILER_MAX_COUNT) count = ECS_LUA_PROFILER_MAX_COUNT;
+
+    prof->count = (int)count;
+
+    lua_pushlightuserdata(L, prof);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &profiler_key);
+
+    /* Threads created afterwards inherit the hook */
+    lua_sethook(prof->L, profiler_hook, LUA_MASKCOUNT, prof->count);
+
+    return 0;
+}
+
+int profiler_stop(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    ecs_lua_profiler *prof = ctx->profiler;
+
+    if(prof == NULL || !prof->enabled) return luaL_error(L, "profiler was not started");
+
+    profiler_disable(L, prof);
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    ecs_map_iter_t it = ecs_map_iter(prof->samples);
+    ecs_lua_sample *s;
+    char count[32];
+
+    while((s = ecs_map_next(&it, ecs_lua_sample, NULL)))
+    {
+        luaL_addstring(&b, s->stack);
+
+        snprintf(count, sizeof(count), " %lld\n", (long long)s->count);
+        luaL_addstring(&b, count);
+    }
+
+    luaL_pushresult(&b);
+    lua_pushinteger(L, prof->total);
+
+    profiler_clear(prof);
+
+    return 2;
+}
@@ -87,9 +87,9 @@ int query_next(lua_State *L)
     if(lua_gettop(L) > 1)
     {
         ecs_filter_t filter;
-        checkfilter(L, it->world, &filter, 2);
-        b = ecs_query_next_w_filter(it, &filter);
-        ecs_filter_fini(&filter);
+        ecs_filter_t *ptr = checkfilter(L, it->world, &filter, 2);
+        b = ecs_query_next_w_filter(it, ptr);
+        if(ptr == &filter) ecs_filter_fini(&filter);
     }
     else b = ecs_query_next(it);
 
@@ -73,18 +73,16 @@ int snapshot_iter(lua_State *L)
     ecs_filter_t filter;
     ecs_filter_t *filter_ptr = NULL;
 
-    if(lua_gettop(L) > 1)
-    {
-        checkfilter(L, w, &filter, 2);
-        filter_ptr = &filter;
-    }
+    if(lua_gettop(L) > 1) filter_ptr = checkfilter(L, w, &filter, 2);
 
     ecs_iter_t it = ecs_snapshot_iter(snapshot, filter_ptr);
 
-    if(filter_ptr) ecs_filter_fini(filter_ptr);
+    if(filter_ptr == &filter) ecs_filter_fini(filter_ptr);
 
     ecs_iter_to_lua(&it, L, true);
 
+    if(filter_ptr && filter_ptr != &filter) ecs_lua_iter_anchor(L, 2);
+
     return 1;
 }
 
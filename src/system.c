@@ -1,11 +1,11 @@
 #include "private.h"
 
-static void print_time(ecs_time_t *time, const char *str)
+/* Bytes ever allocated by the state if it has counters, the heap size otherwise */
+static int64_t lua_bytes(lua_State *L, ecs_lua_ctx *ctx)
 {
-#ifndef NDEBUG
-    double sec = ecs_time_measure(time);
-    ecs_lua_dbg("Lua %s took %f milliseconds", str, sec * 1000.0);
-#endif
+    if(ctx->alloc) return ecs_lua_alloc_total(ctx->alloc);
+
+    return (int64_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
 }
 
 static ecs_world_t **world_buf(lua_State *L, const ecs_world_t *world)
@@ -17,7 +17,6 @@ static ecs_world_t **world_buf(lua_State *L, const ecs_world_t *world)
     ecs_assert(ret == LUA_TUSERDATA, ECS_INTERNAL_ERROR, NULL);
 
     ecs_world_t **wbuf = lua_touserdata(L, -1);
-    ecs_world_t *prev_world = *wbuf;
 
     lua_pop(L, 2);
 
@@ -29,83 +28,198 @@ static void ecs_lua__callback(ecs_iter_t *it)
 {
     ecs_assert(it->binding_ctx != NULL, ECS_INTERNAL_ERROR, NULL);
 
-    ecs_world_t *w = it->world;
     ecs_lua_callback *cb = it->binding_ctx;
-    const ecs_world_t *real_world = ecs_get_world(it->world);
+    int32_t stage_id = ecs_get_stage_id(it->world);
 
-    int stage_id = ecs_get_stage_id(w);
-    int stage_count = ecs_get_stage_count(w);
-    const char *name = ecs_get_name(it->world, it->system);
+    ecs_lua_callback_state *state = stage_id < cb->state_count ? &cb->states[stage_id] : NULL;
 
-    ecs_assert(stage_id == 0, ECS_INTERNAL_ERROR, "Lua callbacks must run on the main thread");
-
-    const EcsLuaHost *host = ecs_singleton_get(w, EcsLuaHost);
-    ecs_assert(host != NULL, ECS_INVALID_PARAMETER, NULL);
+    if(state == NULL || state->L == NULL)
+    {
+        ecs_os_err("Lua %s \"%s\" has no state for stage %d (see ecs.load_stages())",
+                   cb->type_name, ecs_get_name(it->world, it->system), stage_id);
+        return;
+    }
 
-    lua_State *L = host->L; // host->states[stage_id];
+    lua_State *L = state->L;
 
-    ecs_lua_ctx *ctx = ecs_lua_get_context(L, real_world);
+    /* Collected while the state is closing */
+    if(state->func_ref == LUA_NOREF) return;
 
     ecs_lua__prolog(L);
 
     /* Since >2.3.2 it->world != the actual world, we have to
        swap the world pointer for all API calls with it->world (stage pointer)
     */
-    ecs_world_t **wbuf = world_buf(L, real_world);
+    ecs_world_t **wbuf = state->wbuf;
 
     ecs_world_t *prev_world = *wbuf;
     *wbuf = it->world;
 
-    ecs_time_t time;
+    ecs_lua_callback_stats *stats = &state->stats;
 
     ecs_lua_dbg("Lua %s: \"%s\", %d terms, count %d, func ref %d",
-                cb->type_name, name, it->column_count, it->count, cb->func_ref);
+                cb->type_name, ecs_get_name(it->world, it->system), it->column_count, it->count, state->func_ref);
 
-    int type = ecs_lua_rawgeti(L, w, cb->func_ref);
+    int64_t start = ecs_lua_time_ns();
 
-    ecs_assert(type == LUA_TFUNCTION, ECS_INTERNAL_ERROR, NULL);
+    /* The iterator stays on the stack for the readback,
+       recursive invocations get a new table */
+    bool cached = !state->it_busy;
+
+    if(cached) ecs_lua_callback_iter(L, it, cb, state);
+    else ecs_lua_iter_push(L, it, false, cb->flags, cb->readonly);
 
-    ecs_os_get_time(&time);
+    state->it_busy = true;
 
-    ecs_iter_to_lua(it, L, false);
+    int it_idx = lua_gettop(L);
 
-    print_time(&time, "iter serialization");
+    int64_t serialized = ecs_lua_time_ns();
 
-    lua_pushvalue(L, -1);
-    int it_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    int type = lua_rawgeti(L, LUA_REGISTRYINDEX, state->func_ref);
+    ecs_assert(type == LUA_TFUNCTION, ECS_INTERNAL_ERROR, NULL);
+
+    lua_pushvalue(L, -2);
 
-    ecs_os_get_time(&time);
+    int64_t bytes = lua_bytes(L, state->ctx);
+
+    ecs_entity_t prev_owner = state->ctx->owner;
+    state->ctx->owner = it->system;
 
     int ret = lua_pcall(L, 1, 0, 0);
 
+    state->ctx->owner = prev_owner;
     *wbuf = prev_world;
 
-    print_time(&time, "system");
+    if(cached) state->it_busy = false;
+
+    int64_t called = ecs_lua_time_ns();
+
+    /* Without counters this is the net growth of the heap,
+       collections during the call hide allocations */
+    bytes = lua_bytes(L, state->ctx) - bytes;
 
     if(ret)
     {
+        const char *name = ecs_get_name(it->world, it->system);
         const char *err = lua_tostring(L, lua_gettop(L));
         ecs_os_err("error in %s callback \"%s\" (%d): %s", cb->type_name, name, ret, err);
     }
 
     ecs_assert(!ret, ECS_INTERNAL_ERROR, NULL);
 
-    lua_rawgeti(L, LUA_REGISTRYINDEX, it_ref);
+    if(ret)
+    {/* Nothing is read back from a failed callback,
+        columns stored by it must not outlive the iterator */
+        ecs_lua_iter_invalidate(L, it_idx);
+    }
+    else
+    {
+        ecs_assert(lua_type(L, it_idx) == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
+
+        ecs_lua_iter_readback(L, it_idx, state->ctx);
+    }
 
-    ecs_assert(lua_type(L, -1) == LUA_TTABLE, ECS_INTERNAL_ERROR, NULL);
+    int64_t end = ecs_lua_time_ns();
+    int64_t ns = end - start;
 
-    ecs_os_get_time(&time);
+    ecs_lua_dbg("Lua %s took %f ms (serialization %f ms, readback %f ms)", cb->type_name,
+                (called - serialized) / 1e6, (serialized - start) / 1e6, (end - called) / 1e6);
 
-    ecs_lua_to_iter(L, -1);
+    stats->invocations++;
+    stats->rows += it->count;
+    stats->serialize_ns += serialized - start;
+    stats->call_ns += called - serialized;
+    stats->readback_ns += end - called;
+    if(bytes > 0) stats->alloc_bytes += bytes;
 
-    print_time(&time, "iter deserialization");
+    if(!stats->min_ns || ns < stats->min_ns) stats->min_ns = ns;
+    if(ns > stats->max_ns) stats->max_ns = ns;
+
+    /* Tracing is controlled by the main state */
+    ecs_lua_trace *trace = cb->states[0].ctx->trace;
+
+    if(trace != NULL)
+    {
+        ecs_lua_trace_record(trace, stage_id, EcsLuaTraceSystem + cb->type, it->system, start, ns);
+        ecs_lua_trace_record(trace, stage_id, EcsLuaTraceSerialize, 0, start, serialized - start);
+        ecs_lua_trace_record(trace, stage_id, EcsLuaTraceCall, 0, serialized, called - serialized);
+        if(!ret) ecs_lua_trace_record(trace, stage_id, EcsLuaTraceReadback, 0, called, end - called);
+    }
 
-    luaL_unref(L, LUA_REGISTRYINDEX, it_ref);
-    lua_pop(L, 1);
+    lua_settop(L, it_idx - 1);
 
     ecs_lua__epilog(L);
 }
 
+void ecs_lua__system_stats(ecs_iter_t *it)
+{
+    EcsLuaSystemStats *stats = ecs_term_w_size(it, sizeof(EcsLuaSystemStats), 1);
+
+    int32_t i, j;
+    for(i=0; i < it->count; i++)
+    {
+        ecs_lua_callback *cb = ecs_get_system_binding_ctx(it->world, it->entities[i]);
+
+        if(cb == NULL) continue;
+
+        EcsLuaSystemStats *s = &stats[i];
+
+        int64_t prev_count = s->invocations;
+        int64_t prev_ns = s->serialize_ns + s->call_ns + s->readback_ns;
+        int64_t min_ns = 0, max_ns = 0;
+
+        memset(s, 0, offsetof(EcsLuaSystemStats, time));
+
+        /* Workers are idle at the end of the frame */
+        for(j=0; j < cb->state_count; j++)
+        {
+            ecs_lua_callback_stats *st = &cb->states[j].stats;
+
+            s->invocations += st->invocations;
+            s->rows += st->rows;
+            s->serialize_ns += st->serialize_ns;
+            s->call_ns += st->call_ns;
+            s->readback_ns += st->readback_ns;
+            s->alloc_bytes += st->alloc_bytes;
+
+            if(st->min_ns && (!min_ns || st->min_ns < min_ns)) min_ns = st->min_ns;
+            if(st->max_ns > max_ns) max_ns = st->max_ns;
+
+            st->min_ns = st->max_ns = 0;
+        }
+
+        int64_t count = s->invocations - prev_count;
+        int64_t ns = s->serialize_ns + s->call_ns + s->readback_ns - prev_ns;
+        int32_t t = s->t = (s->t + 1) % ECS_STAT_WINDOW;
+
+        /* Milliseconds per invocation */
+        s->time.avg[t] = count ? (float)((double)ns / count / 1000000.0) : 0;
+        s->time.min[t] = (float)(min_ns / 1000000.0);
+        s->time.max[t] = (float)(max_ns / 1000000.0);
+    }
+}
+
+int callback_gc(lua_State *L)
+{
+    ecs_lua_callback *cb = lua_touserdata(L, 1);
+
+    if(cb->states == NULL) return 0;
+
+    /* Stage states are closed with their host,
+       only the main state's handles are released here */
+    ecs_lua_callback_state *state = &cb->states[0];
+
+    luaL_unref(L, LUA_REGISTRYINDEX, state->func_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, state->it_ref);
+
+    ecs_os_free(cb->states);
+
+    cb->states = NULL;
+    cb->state_count = 0;
+
+    return 0;
+}
+
 static int check_events(lua_State *L, ecs_world_t *w, ecs_entity_t *events, int arg)
 {
     ecs_entity_t event = 0;
@@ -146,9 +260,106 @@ static int check_events(lua_State *L, ecs_world_t *w, ecs_entity_t *events, int
     return 1;
 }
 
+static int check_callback_flags(lua_State *L, int arg)
+{
+    int flags = 0;
+
+    if(lua_isnoneornil(L, arg)) return 0;
+
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    lua_getfield(L, arg, "proxy");
+    if(lua_toboolean(L, -1)) flags |= ECS_LUA__PROXY;
+
+    lua_getfield(L, arg, "track");
+    if(lua_toboolean(L, -1)) flags |= ECS_LUA__TRACK;
+
+    lua_getfield(L, arg, "multi_threaded");
+    if(lua_toboolean(L, -1)) flags |= ECS_LUA__MULTI;
+
+    lua_pop(L, 3);
+
+    if((flags & ECS_LUA__PROXY) && (flags & ECS_LUA__TRACK))
+        return luaL_argerror(L, arg, "proxy and track are mutually exclusive");
+
+    return flags;
+}
+
+/* Returns a bitmask of the [in] terms in the filter */
+static uint64_t readonly_terms(ecs_world_t *w, const ecs_filter_desc_t *desc)
+{
+    ecs_filter_t filter;
+    uint64_t readonly = 0;
+
+    if(!desc->expr && !desc->terms[0].id) return 0;
+
+    if(ecs_filter_init(w, &filter, desc)) return 0;
+
+    int32_t i;
+    for(i=0; i < filter.term_count && i < 64; i++)
+    {
+        if(filter.terms[i].inout == EcsIn) readonly |= (uint64_t)1 << i;
+    }
+
+    ecs_filter_fini(&filter);
+
+    return readonly;
+}
+
+static void init_state(lua_State *L, ecs_world_t *w, ecs_lua_callback_state *state, ecs_lua_ctx *ctx)
+{
+    lua_pushvalue(L, 1);
+
+    state->L = L;
+    state->ctx = ctx;
+    state->wbuf = world_buf(L, ecs_get_world(w));
+    state->func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    state->it_ref = LUA_NOREF;
+    state->it_busy = false;
+}
+
+/* Scripts loaded into a worker stage state bind their functions
+   to the callbacks created by the main state */
+static int bind_stage_callback(lua_State *L, ecs_world_t *w, ecs_lua_ctx *ctx, enum EcsLuaCallbackType type)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    const char *name = luaL_checkstring(L, 2);
+
+    ecs_entity_t e = ecs_lookup_fullpath(w, name);
+
+    if(!e) return luaL_error(L, "callback \"%s\" must be created by the main state first", name);
+
+    ecs_lua_callback *cb = type == EcsLuaSystem ? ecs_get_system_binding_ctx(w, e) : NULL;
+
+    /* Triggers, observers and single-threaded systems run on the main state */
+    if(cb != NULL && (cb->flags & ECS_LUA__MULTI))
+    {
+        int32_t stage = ctx->stage;
+
+        if(stage >= cb->state_count)
+        {
+            cb->states = ecs_os_realloc_n(cb->states, ecs_lua_callback_state, stage + 1);
+            ecs_os_memset(&cb->states[cb->state_count], 0, (stage + 1 - cb->state_count) * sizeof(ecs_lua_callback_state));
+            cb->state_count = stage + 1;
+        }
+
+        ecs_lua_callback_state *state = &cb->states[stage];
+
+        if(state->L != NULL) luaL_unref(L, LUA_REGISTRYINDEX, state->func_ref);
+
+        init_state(L, w, state, ctx);
+    }
+
+    lua_pushinteger(L, e);
+
+    return 1;
+}
+
 static int new_callback(lua_State *L, ecs_world_t *w, enum EcsLuaCallbackType type)
 {
-    ecs_lua_ctx *ctx = ecs_lua_get_context(L, w);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    if(ctx->stage) return bind_stage_callback(L, w, ctx, type);
 
     ecs_entity_t e = 0;
     luaL_checktype(L, 1, LUA_TFUNCTION);
@@ -158,8 +369,14 @@ static int new_callback(lua_State *L, ecs_world_t *w, enum EcsLuaCallbackType ty
 
     ecs_lua_callback *cb = lua_newuserdata(L, sizeof(ecs_lua_callback));
 
+    cb->states = NULL;
+    cb->state_count = 0;
+    luaL_setmetatable(L, "ecs_callback_t");
+
     ecs_lua_ref(L, w);
 
+    cb->flags = check_callback_flags(L, 5);
+
     if(type == EcsLuaTrigger)
     {
         ecs_trigger_desc_t desc =
@@ -176,6 +393,11 @@ static int new_callback(lua_State *L, ecs_world_t *w, enum EcsLuaCallbackType ty
 
         e = ecs_trigger_init(w, &desc);
 
+        ecs_filter_desc_t filter = { .expr = signature };
+        if(signature == NULL) filter.terms[0] = desc.term;
+
+        cb->readonly = readonly_terms(w, &filter);
+
         cb->type_name = "trigger";
     }
     else if(type == EcsLuaObserver)
@@ -194,6 +416,8 @@ static int new_callback(lua_State *L, ecs_world_t *w, enum EcsLuaCallbackType ty
 
         e = ecs_observer_init(w, &desc);
 
+        cb->readonly = readonly_terms(w, &desc.filter);
+
         cb->type_name = "observer";
     }
     else
@@ -205,20 +429,30 @@ static int new_callback(lua_State *L, ecs_world_t *w, enum EcsLuaCallbackType ty
             .entity = { .name = name, .add = phase },
             .query.filter.expr = signature,
             .callback = ecs_lua__callback,
-            .binding_ctx = cb
+            .binding_ctx = cb,
+            .multi_threaded = cb->flags & ECS_LUA__MULTI
         };
 
         if(signature == NULL && !lua_isnoneornil(L, 4)) check_filter_desc(L, w, &desc.query.filter, 4);
 
         e = ecs_system_init(w, &desc);
 
+        if(e) ecs_add_id(w, e, ecs_id(EcsLuaSystemStats));
+
+        cb->readonly = readonly_terms(w, &desc.query.filter);
+
         cb->type_name = "system";
     }
 
     if(!e) return luaL_error(L, "failed to create %s", cb->type_name);
 
-    lua_pushvalue(L, 1);
-    cb->func_ref = ecs_lua_ref(L, w);
+    if(type != EcsLuaSystem) cb->flags &= ~ECS_LUA__MULTI;
+
+    /* Resolved once, the callback only needs the pcall */
+    cb->states = ecs_os_calloc_t(ecs_lua_callback_state);
+    cb->state_count = 1;
+    init_state(L, w, &cb->states[0], ctx);
+
     cb->param_ref = LUA_NOREF;
     cb->type = type;
 
@@ -251,7 +485,15 @@ int run_system(lua_State *L)
 
     ecs_lua_callback *sys = ecs_get_system_binding_ctx(w, system);
 
-    if(sys == NULL) return luaL_argerror(L, 1, "not a Lua system");
+    if(sys == NULL)
+    {/* Kernels have no Lua state, and no param */
+        if(!ecs_lua_is_kernel(w, system) || !lua_isnoneornil(L, 3))
+            return luaL_argerror(L, 1, "not a Lua system");
+
+        lua_pushinteger(L, ecs_run(w, system, delta_time, NULL));
+
+        return 1;
+    }
 
     int tmp = sys->param_ref;
 
@@ -0,0 +1,299 @@
+#include "private.h"
+
+#include <stdio.h>
+
+/* ecs.trace_begin() records complete events (begin + duration) into one
+   ring buffer per stage, each ring only has the thread of its stage as
+   writer. ecs.trace_dump() writes them as Chrome trace_event JSON.
+   Frames are recorded by PreFrame/PostFrame systems of the host state,
+   so they are traced no matter who calls ecs_progress() */
+
+typedef struct ecs_lua_trace_event
+{
+    int64_t ts;
+    int64_t dur;
+    ecs_entity_t entity;
+    int32_t kind;
+}ecs_lua_trace_event;
+
+typedef struct ecs_lua_trace_ring
+{
+    int64_t head; /* Total events written */
+    ecs_lua_trace_event *events;
+}ecs_lua_trace_ring;
+
+struct ecs_lua_trace
+{
+    bool enabled;
+    int32_t capacity; /* Events per ring, a power of 2 */
+    int64_t start;
+    int64_t frame_start; /* 0 outside of a traced frame */
+
+    int32_t ring_count; /* Stages when tracing began */
+    ecs_lua_trace_ring *rings;
+};
+
+static const char *trace_names[] =
+{
+    [EcsLuaTraceFrame] = "frame",
+    [EcsLuaTraceProgress] = "progress",
+    [EcsLuaTraceSystem] = "system",
+    [EcsLuaTraceTrigger] = "trigger",
+    [EcsLuaTraceObserver] = "observer",
+    [EcsLuaTraceSerialize] = "serialize",
+    [EcsLuaTraceCall] = "call",
+    [EcsLuaTraceReadback] = "readback"
+};
+
+void ecs_lua_trace_record(ecs_lua_trace *trace, int32_t stage, int32_t kind, ecs_entity_t e, int64_t ts, int64_t dur)
+{
+    if(trace == NULL || !trace->enabled || stage >= trace->ring_count) return;
+
+    ecs_lua_trace_ring *ring = &trace->rings[stage];
+    ecs_lua_trace_event *ev = &ring->events[ring->head & (trace->capacity - 1)];
+
+    ev->ts = ts;
+    ev->dur = dur;
+    ev->entity = e;
+    ev->kind = kind;
+
+    ring->head++;
+}
+
+static ecs_lua_trace *host_trace(ecs_iter_t *it)
+{
+    if(ecs_get_stage_id(it->world)) return NULL;
+
+    const EcsLuaHost *host = ecs_singleton_get(it->world, EcsLuaHost);
+
+    if(host == NULL || host->ctx == NULL) return NULL;
+
+    ecs_lua_trace *trace = host->ctx->trace;
+
+    return trace && trace->enabled ? trace : NULL;
+}
+
+void ecs_lua__trace_frame_begin(ecs_iter_t *it)
+{
+    ecs_lua_trace *trace = host_trace(it);
+
+    if(trace) trace->frame_start = ecs_lua_time_ns();
+}
+
+void ecs_lua__trace_frame_end(ecs_iter_t *it)
+{
+    ecs_lua_trace *trace = host_trace(it);
+
+    if(trace == NULL || !trace->frame_start) return;
+
+    int64_t start = trace->frame_start;
+    trace->frame_start = 0;
+
+    ecs_lua_trace_record(trace, 0, EcsLuaTraceFrame, 0, start, ecs_lua_time_ns() - start);
+}
+
+bool ecs_lua_trace_frames(const ecs_world_t *world, ecs_lua_ctx *ctx)
+{
+    const EcsLuaHost *host = ecs_singleton_get(world, EcsLuaHost);
+
+    return host && host->ctx == ctx;
+}
+
+static void trace_fini(ecs_lua_trace *trace)
+{
+    int32_t i;
+    for(i=0; i < trace->ring_count; i++) ecs_os_free(trace->rings[i].events);
+
+    ecs_os_free(trace->rings);
+
+    trace->rings = NULL;
+    trace->ring_count = 0;
+    trace->enabled = false;
+}
+
+static int trace_gc(lua_State *L)
+{
+    trace_fini(lua_touserdata(L, 1));
+
+    return 0;
+}
+
+/* Returns registry[world][ECS_LUA_TRACE], it is created on first use */
+static ecs_lua_trace *get_trace(lua_State *L, ecs_lua_ctx *ctx)
+{
+    if(ctx->trace) return ctx->trace;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ctx->world);
+
+    ecs_lua_trace *trace = lua_newuserdata(L, sizeof(ecs_lua_trace));
+    memset(trace, 0, sizeof(ecs_lua_trace));
+
+    if(luaL_newmetatable(L, "ecs_trace_t"))
+    {
+        lua_pushcfunction(L, trace_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+
+    lua_setmetatable(L, -2);
+
+    lua_rawseti(L, -2, ECS_LUA_TRACE);
+    lua_pop(L, 1);
+
+    ctx->trace = trace;
+
+    return trace;
+}
+
+static int64_t trace_count(ecs_lua_trace *trace)
+{
+    int64_t count = 0;
+
+    int32_t i;
+    for(i=0; i < trace->ring_count; i++)
+    {
+        int64_t head = trace->rings[i].head;
+        count += head < trace->capacity ? head : trace->capacity;
+    }
+
+    return count;
+}
+
+int trace_begin(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    lua_Integer capacity = luaL_optinteger(L, 1, 16384);
+
+    if(ctx->stage) return luaL_error(L, "tracing can only be started by the main state");
+    if(capacity < 1 || capacity > (1 << 24)) return luaL_argerror(L, 1, "invalid capacity");
+
+    ecs_lua_trace *trace = get_trace(L, ctx);
+
+    /* Workers may still be recording into the rings while the world is progressing */
+    if(trace->enabled) return luaL_error(L, "tracing is already enabled");
+    if(ecs_is_deferred(w)) return luaL_error(L, "cannot start tracing while the world is progressing");
+
+    trace_fini(trace);
+
+    int32_t n = 1;
+    while(n < capacity) n <<= 1;
+
+    trace->capacity = n;
+    trace->ring_count = ecs_get_stage_count(w);
+    if(trace->ring_count < 1) trace->ring_count = 1;
+
+    trace->rings = ecs_os_calloc_n(ecs_lua_trace_ring, trace->ring_count);
+
+    int32_t i;
+    for(i=0; i < trace->ring_count; i++)
+    {
+        trace->rings[i].events = ecs_os_malloc_n(ecs_lua_trace_event, n);
+    }
+
+    trace->start = ecs_lua_time_ns();
+    trace->frame_start = 0;
+    trace->enabled = true;
+
+    return 0;
+}
+
+int trace_end(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    ecs_lua_trace *trace = ctx->trace;
+
+    if(trace == NULL) return luaL_error(L, "tracing was not started");
+
+    trace->enabled = false;
+
+    lua_pushinteger(L, trace_count(trace));
+
+    return 1;
+}
+
+static void write_string(FILE *f, const char *str)
+{
+    fputc('"', f);
+
+    for(; *str; str++)
+    {
+        unsigned char c = *str;
+
+        if(c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if(c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+
+    fputc('"', f);
+}
+
+static void write_event(FILE *f, const ecs_world_t *world, ecs_lua_trace *trace, ecs_lua_trace_event *ev, int32_t tid)
+{
+    const char *cat = trace_names[ev->kind];
+    const char *name = NULL;
+    char buf[32];
+
+    if(ev->kind >= EcsLuaTraceSerialize) cat = "lua";
+    else if(ev->entity)
+    {
+        if(ecs_is_alive(world, ev->entity)) name = ecs_get_name(world, ev->entity);
+
+        if(name == NULL)
+        {
+            snprintf(buf, sizeof(buf), "#%llu", (unsigned long long)ev->entity);
+            name = buf;
+        }
+    }
+
+    fputs("{\"name\":", f);
+    write_string(f, name ? name : trace_names[ev->kind]);
+
+    fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+        cat, tid, (ev->ts - trace->start) / 1000.0, ev->dur / 1000.0);
+}
+
+int trace_dump(lua_State *L)
+{
+    ecs_world_t *w = ecs_lua_world(L);
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    const char *path = luaL_checkstring(L, 1);
+
+    ecs_lua_trace *trace = ctx->trace;
+
+    if(trace == NULL) return luaL_error(L, "tracing was not started");
+
+    FILE *f = fopen(path, "w");
+
+    if(f == NULL) return luaL_fileresult(L, 0, path);
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", f);
+
+    int64_t count = 0;
+
+    int32_t i;
+    for(i=0; i < trace->ring_count; i++)
+    {
+        ecs_lua_trace_ring *ring = &trace->rings[i];
+        int64_t j = ring->head > trace->capacity ? ring->head - trace->capacity : 0;
+
+        /* Oldest to newest */
+        for(; j < ring->head; j++)
+        {
+            if(count++) fputs(",\n", f);
+
+            write_event(f, w, trace, &ring->events[j & (trace->capacity - 1)], i);
+        }
+    }
+
+    fputs("\n]}\n", f);
+
+    if(fclose(f)) return luaL_fileresult(L, 0, path);
+
+    lua_pushinteger(L, count);
+
+    return 1;
+}
@@ -123,6 +123,57 @@ int world_stats(lua_State *L)
 
     ecs_ptr_to_lua(w, L, ecs_id(EcsLuaWorldStats), &world_stats);
 
+    ecs_lua_ctx *ctx = ecs_lua_get_context(L, ecs_get_world(w));
+
+    int64_t rows_written = ctx->rows_written;
+    int64_t rows_skipped = ctx->rows_skipped;
+    int64_t defer_queued = ctx->defer_queued;
+    int64_t defer_coalesced = ctx->defer_coalesced;
+    int64_t defer_flushes = ctx->defer_flushes;
+
+    /* Include the worker stage states */
+    int32_t i, count = ecs_get_stage_count(w);
+    for(i=1; i < count && !ctx->stage; i++)
+    {
+        lua_State *S = ecs_lua_get_stage_state(w, i);
+        if(S == NULL) continue;
+
+        ecs_lua_ctx *sctx = ecs_lua_get_context(S, NULL);
+
+        rows_written += sctx->rows_written;
+        rows_skipped += sctx->rows_skipped;
+        defer_queued += sctx->defer_queued;
+        defer_coalesced += sctx->defer_coalesced;
+        defer_flushes += sctx->defer_flushes;
+    }
+
+    lua_pushinteger(L, rows_written);
+    lua_setfield(L, -2, "lua_rows_written");
+
+    lua_pushinteger(L, rows_skipped);
+    lua_setfield(L, -2, "lua_rows_skipped");
+
+    lua_pushinteger(L, defer_queued);
+    lua_setfield(L, -2, "lua_defer_queued");
+
+    lua_pushinteger(L, defer_coalesced);
+    lua_setfield(L, -2, "lua_defer_coalesced");
+
+    lua_pushinteger(L, defer_flushes);
+    lua_setfield(L, -2, "lua_defer_flushes");
+
+    ecs_lua_memory_totals memory;
+    ecs_lua_memory_get_totals(L, w, &memory);
+
+    lua_pushinteger(L, memory.bytes);
+    lua_setfield(L, -2, "lua_memory_bytes");
+
+    lua_pushinteger(L, memory.peak);
+    lua_setfield(L, -2, "lua_memory_peak");
+
+    lua_pushinteger(L, memory.count);
+    lua_setfield(L, -2, "lua_memory_count");
+
     return 1;
 }
 
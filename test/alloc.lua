@@ -0,0 +1,50 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+--Allocations made by Lua system invocations, counted by the test host
+
+if not t.alloc_count then return end
+
+local AllocPos = ecs.struct("AllocPos", "{float x; float y;}")
+
+ecs.set(ecs.new(), AllocPos, { x = 1, y = 2 })
+
+local invoked = 0
+
+local function sys(it)
+    invoked = invoked + 1
+    assert(it.count == 1)
+    assert(it.delta_time > 0)
+end
+
+local N = 500
+
+for i = 1, N do
+    ecs.system(sys, "AllocSys" .. i, ecs.OnUpdate, "AllocPos")
+end
+
+--first frame creates the iterator tables
+ecs.progress(1.0 / 60)
+
+collectgarbage("stop")
+
+local frames = 10
+local before = t.alloc_count()
+
+for i = 1, frames do
+    ecs.progress(1.0 / 60)
+end
+
+local per_frame = (t.alloc_count() - before) / frames
+
+collectgarbage("restart")
+
+print(string.format("%d systems: %.1f allocations per frame", N, per_frame))
+
+assert(invoked == N * (frames + 1))
+
+--iterator tables are reused, allocations no longer scale with systems
+assert(per_frame < N)
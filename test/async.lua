@@ -0,0 +1,74 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+if not t.threading then
+    print("no threading support, skipping")
+    return
+end
+
+local PathQuery = ecs.struct("PathQuery", "{int32_t from; int32_t to;}")
+local PathResult = ecs.struct("PathResult", "{int32_t steps; float cost; bool found;}")
+
+local function path(q)
+    local steps = 0
+    for i = q.from, q.to do steps = steps + 1 end
+
+    return { steps = steps, cost = steps * 0.5, found = steps > 0 }
+end
+
+local f = ecs.async(path, PathQuery, { from = 1, to = 100 }, PathResult)
+
+local done, res = f:wait()
+assert(done)
+assert(res.steps == 100)
+assert(res.cost == 50)
+assert(res.found == true)
+
+--no argument or result type
+local f2 = ecs.async(function () return 1 end)
+assert(select(2, ecs.async_wait(f2)) == nil)
+
+--errors are raised by poll/wait
+local f3 = ecs.async(function () error("job error") end)
+assert(not pcall(f3.wait, f3))
+
+local captured = 1
+assert(not pcall(ecs.async, function () return captured end))
+assert(not pcall(ecs.async, print))
+assert(not pcall(ecs.async, path, PathQuery, { from = "x" }))
+
+ecs.set_async_threads(4)
+
+--results are picked up by a system on a later frame
+local pending = {}
+local results = 0
+
+for i = 1, 8 do
+    pending[i] = ecs.async(path, PathQuery, { from = 1, to = i }, PathResult)
+end
+
+local function collect(it)
+    for i, fut in pairs(pending) do
+        local ok, r = fut:poll()
+
+        if ok then
+            assert(r.steps == i)
+            pending[i] = nil
+            results = results + 1
+        end
+    end
+end
+
+ecs.system(collect, "AsyncCollect", ecs.OnUpdate)
+
+local frames = 0
+
+while results < 8 and frames < 1000000 do
+    ecs.progress(0)
+    frames = frames + 1
+end
+
+assert(results == 8)
@@ -0,0 +1,255 @@
+#include <flecs_lua.h>
+
+#include <lualib.h>
+#include <lauxlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Microbenchmarks for the binding's hot paths,
+   usage: b <script> [output.json] [--pool]
+
+   The state uses malloc unless --pool is given,
+   then it is created with ECS_LUA_POOL_ALLOC */
+
+#define BENCH_MAX_RESULTS 256
+
+typedef struct bench_result
+{
+    char *name;
+    lua_Integer ops;
+    double ns;
+    int64_t bytes;
+    int64_t allocs;
+    int64_t os_allocs;
+    char *error;
+}bench_result;
+
+static bench_result results[BENCH_MAX_RESULTS];
+static int32_t result_count;
+
+static int64_t lua_bytes;
+static int64_t lua_allocs;
+static int64_t os_allocs;
+
+/* Allocator of the state when it is not malloc */
+static lua_Alloc inner_allocf;
+static void *inner_ud;
+
+static ecs_os_api_malloc_t os_malloc;
+static ecs_os_api_calloc_t os_calloc;
+static ecs_os_api_realloc_t os_realloc;
+
+static void *bench_os_malloc(ecs_size_t size)
+{
+    os_allocs++;
+    return os_malloc(size);
+}
+
+static void *bench_os_calloc(ecs_size_t size)
+{
+    os_allocs++;
+    return os_calloc(size);
+}
+
+static void *bench_os_realloc(void *ptr, ecs_size_t size)
+{
+    os_allocs++;
+    return os_realloc(ptr, size);
+}
+
+/* Counts the bytes requested by the Lua state */
+static void *Allocf(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    size_t old = ptr ? osize : 0;
+
+    if(nsize > old)
+    {
+        lua_bytes += nsize - old;
+        lua_allocs++;
+    }
+
+    if(inner_allocf) return inner_allocf(inner_ud, ptr, osize, nsize);
+
+    if(!nsize)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    return realloc(ptr, nsize);
+}
+
+/* bench.run(name, ops, func): func(ops) must perform ops operations */
+static int bench_run(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    lua_Integer ops = luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    if(ops < 1) return luaL_argerror(L, 2, "at least one op is required");
+    if(result_count == BENCH_MAX_RESULTS) return luaL_error(L, "too many benchmarks");
+
+    bench_result *r = &results[result_count++];
+
+    r->name = ecs_os_strdup(name);
+    r->ops = ops;
+
+    lua_gc(L, LUA_GCCOLLECT, 0);
+
+    int64_t bytes = lua_bytes, allocs = lua_allocs, os = os_allocs;
+
+    ecs_time_t start;
+    ecs_os_get_time(&start);
+
+    lua_pushvalue(L, 3);
+    lua_pushinteger(L, ops);
+
+    if(lua_pcall(L, 1, 0, 0))
+    {
+        r->error = ecs_os_strdup(lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+
+    r->ns = ecs_time_measure(&start) * 1e9 / (double)ops;
+    r->bytes = lua_bytes - bytes;
+    r->allocs = lua_allocs - allocs;
+    r->os_allocs = os_allocs - os;
+
+    fprintf(stderr, "%-32s %12.1f ns/op %10.1f B/op%s%s\n", name, r->ns,
+            (double)r->bytes / (double)ops, r->error ? " error: " : "", r->error ? r->error : "");
+
+    return 0;
+}
+
+static int luaopen_bench(lua_State *L)
+{
+    luaL_Reg lib[] =
+    {
+        { "run", bench_run },
+        { NULL, NULL }
+    };
+
+    luaL_newlib(L, lib);
+
+    return 1;
+}
+
+static void print_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+
+    for(; *str; str++)
+    {
+        if(*str == '"' || *str == '\\') fputc('\\', out);
+        if((unsigned char)*str >= 0x20) fputc(*str, out);
+    }
+
+    fputc('"', out);
+}
+
+static void print_json(FILE *out, const char *allocator)
+{
+    int32_t i;
+
+    fprintf(out, "{\n  \"allocator\": \"%s\",\n  \"benchmarks\": [\n", allocator);
+
+    for(i=0; i < result_count; i++)
+    {
+        bench_result *r = &results[i];
+
+        fprintf(out, "    { \"name\": ");
+        print_string(out, r->name);
+        fprintf(out, ", \"ops\": %lld, \"ns_per_op\": %.3f, \"bytes_per_op\": %.3f, \"allocs_per_op\": %.3f, \"os_allocs_per_op\": %.3f",
+                (long long)r->ops, r->ns, (double)r->bytes / r->ops, (double)r->allocs / r->ops, (double)r->os_allocs / r->ops);
+
+        if(r->error)
+        {
+            fprintf(out, ", \"error\": ");
+            print_string(out, r->error);
+        }
+
+        fprintf(out, " }%s\n", i + 1 < result_count ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2) return 1;
+
+    ecs_os_set_api_defaults();
+    ecs_os_api_t os_api = ecs_os_api;
+
+    os_malloc = os_api.malloc_;
+    os_calloc = os_api.calloc_;
+    os_realloc = os_api.realloc_;
+
+    os_api.malloc_ = bench_os_malloc;
+    os_api.calloc_ = bench_os_calloc;
+    os_api.realloc_ = bench_os_realloc;
+
+    ecs_os_set_api(&os_api);
+
+    ecs_world_t *w = ecs_init();
+
+    ECS_IMPORT(w, FlecsLua);
+
+    const char *output = NULL;
+    bool pool = false;
+
+    int i;
+    for(i=2; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--pool")) pool = true;
+        else output = argv[i];
+    }
+
+    lua_State *L;
+
+    if(pool)
+    {
+        L = ecs_lua_get_state_w_flags(w, ECS_LUA_POOL_ALLOC);
+
+        /* Count on top of the pool */
+        inner_allocf = lua_getallocf(L, &inner_ud);
+        lua_setallocf(L, Allocf, NULL);
+    }
+    else
+    {
+        L = lua_newstate(Allocf, NULL);
+        ecs_lua_set_state(w, L);
+    }
+
+    luaL_openlibs(L);
+
+    luaL_requiref(L, "bench", luaopen_bench, 0);
+    lua_pop(L, 1);
+
+    int ret = luaL_dofile(L, argv[1]);
+
+    if(ret) fprintf(stderr, "script error: %s\n", lua_tostring(L, -1));
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+
+    if(out)
+    {
+        print_json(out, pool ? "pool" : "malloc");
+        if(out != stdout) fclose(out);
+    }
+
+    for(i=0; i < result_count; i++)
+    {
+        ecs_os_free(results[i].name);
+        ecs_os_free(results[i].error);
+    }
+
+    /* The state is closed by ecs_fini() */
+    if(pool) lua_setallocf(L, inner_allocf, inner_ud);
+
+    ecs_fini(w);
+
+    return ret;
+}
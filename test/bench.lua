@@ -0,0 +1,116 @@
+local ecs = require "ecs"
+local bench = require "bench"
+
+--Fixed sizes and seed so runs are comparable, results are printed as JSON by the host.
+--Run with and without --pool to compare the pool allocator with malloc
+
+math.randomseed(0)
+
+local N = 10000
+
+local Flat = ecs.struct("BenchFlat", "{float x; float y; float z;}")
+local Nested = ecs.struct("BenchNested", "{BenchFlat pos; BenchFlat vel; int32_t id;}")
+local Array = ecs.struct("BenchArray", "{float values[8];}")
+local Body = ecs.struct("BenchBody", "{BenchFlat pos; BenchFlat vel; int32_t mass; uint8_t flags[4];}")
+local vector_ok, Vector = pcall(ecs.struct, "BenchVector", "{ecs_vector(float) values;}")
+
+local shapes =
+{
+    { "flat", Flat, { x = 1, y = 2, z = 3 } },
+    { "nested", Nested, { pos = { x = 1, y = 2, z = 3 }, vel = { x = 4, y = 5, z = 6 }, id = 7 } },
+    { "array", Array, { values = { 1, 2, 3, 4, 5, 6, 7, 8 } } },
+    { "body", Body, { pos = { x = 1, y = 2, z = 3 }, vel = { x = 1, y = 2, z = 3 }, mass = 4, flags = { 1, 2, 3, 4 } } }
+}
+
+if vector_ok then
+    shapes[#shapes + 1] = { "vector", Vector, { values = { 1, 2, 3, 4 } } }
+end
+
+local ents = ecs.bulk_new(N)
+
+for _, shape in ipairs(shapes) do
+    local name, type, value = shape[1], shape[2], shape[3]
+
+    bench.run("set/" .. name, N, function (n)
+        for i = 1, n do ecs.set(ents[i], type, value) end
+    end)
+
+    bench.run("get/" .. name, N, function (n)
+        for i = 1, n do ecs.get(ents[i], type) end
+    end)
+end
+
+local frames = 10
+
+local empty = ecs.system(function (it) end, "BenchEmpty", 0)
+
+bench.run("system/empty_callback", N, function (n)
+    for i = 1, n do ecs.run(empty, 0) end
+end)
+
+local each = ecs.system(function (it)
+    for p in ecs.each(it) do p.x = p.x + 1 end
+end, "BenchEach", 0, "BenchFlat")
+
+bench.run("each/row", N * frames, function (n)
+    for i = 1, frames do ecs.run(each, 0) end
+end)
+
+local move = ecs.system(function (it)
+    for b in ecs.each(it) do
+        b.pos.x = b.pos.x + b.vel.x
+        b.pos.y = b.pos.y + b.vel.y
+        b.pos.z = b.pos.z + b.vel.z
+    end
+end, "BenchMove", 0, "BenchBody")
+
+bench.run("each/nested_row", N * frames, function (n)
+    for i = 1, frames do ecs.run(move, 0) end
+end)
+
+local columns = ecs.system(function (it)
+    local c = it.columns[1]
+end, "BenchColumns", 0, "BenchFlat")
+
+bench.run("system/columns_row", N * frames, function (n)
+    for i = 1, frames do ecs.run(columns, 0) end
+end)
+
+local q = ecs.query("BenchFlat")
+
+bench.run("query_next/row", N * frames, function (n)
+    for i = 1, frames do
+        local it = ecs.query_iter(q)
+        while ecs.query_next(it) do end
+    end
+end)
+
+bench.run("new/type_expr", N, function (n)
+    for i = 1, n do ecs.new(nil, "BenchFlat, BenchNested") end
+end)
+
+bench.run("bulk_new/entity", N * frames, function (n)
+    for i = 1, frames do ecs.bulk_new(Flat, N, true) end
+end)
+
+bench.run("snapshot/take_restore", 100, function (n)
+    for i = 1, n do ecs.snapshot_restore(ecs.snapshot()) end
+end)
+
+--Overhead of the sampling profiler on a Lua workload
+
+local function workload(n)
+    local s = 0
+    for i = 1, n do s = s + (i % 7) * 0.5 end
+    return s
+end
+
+bench.run("profiler/off", N * 100, function (n)
+    workload(n)
+end)
+
+bench.run("profiler/on", N * 100, function (n)
+    ecs.profiler_start(1000)
+    workload(n)
+    ecs.profiler_stop()
+end)
@@ -0,0 +1,181 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+local DPos = ecs.struct("DPos", "{float x; float y;}")
+local DVel = ecs.struct("DVel", "{float x; float y;}")
+local DTag = ecs.tag("DTag")
+
+local e = ecs.new()
+local set_count = 0
+
+ecs.observer(function (it) set_count = set_count + it.count end, "DPosSet", ecs.OnSet, "DPos")
+
+assert(not ecs.is_deferred())
+
+local stats = ecs.world_stats()
+
+ecs.defer_begin()
+assert(ecs.is_deferred())
+
+ecs.set(e, DPos, { x = 1, y = 2 })
+ecs.add(e, DVel)
+ecs.add(e, DTag)
+
+--nothing is applied until defer_end()
+assert(not ecs.has(e, DPos))
+assert(not ecs.has(e, DVel))
+
+--add + remove cancel out
+ecs.remove(e, DTag)
+
+--sets of the same component are merged
+ecs.set(e, DPos, { y = 3 })
+
+assert(ecs.defer_end() == 5)
+assert(not ecs.is_deferred())
+
+assert(ecs.has(e, DPos) and ecs.has(e, DVel))
+assert(not ecs.has(e, DTag))
+
+local p = ecs.get(e, DPos)
+assert(p.x == 1 and p.y == 3)
+assert(set_count == 1)
+
+local stats2 = ecs.world_stats()
+assert(stats2.lua_defer_queued - stats.lua_defer_queued == 5)
+assert(stats2.lua_defer_flushes - stats.lua_defer_flushes == 1)
+assert(stats2.lua_defer_coalesced - stats.lua_defer_coalesced == 2)
+
+--nested calls apply the queue once
+ecs.defer_begin()
+ecs.defer_begin()
+ecs.remove(e, DVel)
+assert(ecs.defer_end() == 0)
+assert(ecs.has(e, DVel))
+assert(ecs.defer_end() == 1)
+assert(not ecs.has(e, DVel))
+
+assert(not pcall(ecs.defer_end))
+
+--operations before a delete are dropped
+local ents = ecs.bulk_new(10)
+
+local a, b = ecs.batch(function (x)
+    for i, ent in ipairs(ents) do
+        ecs.set(ent, DPos, { x = i })
+        ecs.add(ent, DTag)
+    end
+
+    ecs.delete(ents[1])
+
+    return x, 2
+end, 1)
+
+assert(a == 1 and b == 2)
+assert(not ecs.is_alive(ents[1]))
+
+for i = 2, #ents do
+    assert(ecs.get(ents[i], DPos).x == i)
+    assert(ecs.has(ents[i], DTag))
+end
+
+--the queue is applied when the function fails
+local ok = pcall(ecs.batch, function ()
+    ecs.remove(ents[2], DTag)
+    error("batch error")
+end)
+
+assert(not ok)
+assert(not ecs.is_deferred())
+assert(not ecs.has(ents[2], DTag))
+
+--values are copied when they are queued
+local tmp = {}
+
+ecs.batch(function ()
+    for i = 2, 4 do
+        tmp.x = i * 10
+        ecs.set(ents[i], DPos, tmp)
+    end
+end)
+
+for i = 2, 4 do assert(ecs.get(ents[i], DPos).x == i * 10) end
+
+--the error of the function is kept if the flush fails too
+local ok, err = pcall(ecs.batch, function ()
+    ecs.set(ents[2], DPos, { x = "not a number" })
+    error("first error")
+end)
+
+assert(not ok and err:find("first error", 1, true))
+assert(not ecs.is_deferred())
+
+--pairs and new entities
+local parent = ecs.new()
+local child
+
+ecs.batch(function ()
+    ecs.add(ents[3], ecs.ChildOf, parent)
+    child = ecs.set(0, DPos, { x = 5 })
+end)
+
+assert(ecs.has(ents[3], ecs.ChildOf, parent))
+assert(ecs.get(child, DPos).x == 5)
+
+--remove + add resets the component
+local removed = 0
+ecs.observer(function (it) removed = removed + it.count end, "DVelRemoved", ecs.OnRemove, "DVel")
+
+ecs.set(ents[4], DVel, { x = 7 })
+
+ecs.batch(function ()
+    ecs.remove(ents[4], DVel)
+    ecs.add(ents[4], DVel)
+end)
+
+assert(ecs.has(ents[4], DVel))
+assert(removed == 1)
+
+--add + remove still cancel out
+ecs.batch(function ()
+    ecs.add(ents[4], DTag)
+    ecs.remove(ents[4], DTag)
+end)
+
+assert(not ecs.has(ents[4], DTag))
+
+--an entity is deleted after the ops that reference it
+local target = ecs.new()
+local source = ecs.new()
+
+ecs.batch(function ()
+    ecs.add(source, target)
+    ecs.delete(target)
+end)
+
+assert(not ecs.is_alive(target))
+assert(ecs.is_alive(source))
+
+--setters keep the call order
+local hx = ecs.member(DPos, "x")
+
+ecs.batch(function ()
+    ecs.set(ents[2], DPos, { x = 1, y = 1 })
+    ecs.setm(ents[2], hx, 5)
+    ecs.set_fields(ents[3], DPos, 1, 1)
+    ecs.set_fields(ents[3], DPos, nil, 6)
+    ecs.set_many({ ents[4] }, DPos, { x = 2, y = 2 })
+    ecs.setm(ents[4], hx, 8)
+end)
+
+local p2 = ecs.get(ents[2], DPos)
+assert(p2.x == 5 and p2.y == 1)
+
+local p3 = ecs.get(ents[3], DPos)
+assert(p3.x == 1 and p3.y == 6)
+
+local p4 = ecs.get(ents[4], DPos)
+assert(p4.x == 8 and p4.y == 2)
@@ -231,3 +231,162 @@ assert(not pcall(function () ecs.bulk_delete({include_kind = false}) end))
 assert(not pcall(function () ecs.bulk_delete({exclude_kind = false}) end))
 assert(not pcall(function () ecs.bulk_delete({include = 0xD00D00}) end))
 assert(not pcall(function () ecs.bulk_delete({exclude = 0xD00D00}) end))
+
+local FieldsPos = ecs.struct("FieldsPos", "{float x; float y;}")
+local FieldsBody = ecs.struct("FieldsBody", "{FieldsPos pos; int32_t mass; bool alive;}")
+
+local fe = ecs.set_fields(0, FieldsPos, 1.5, 2.5)
+local x, y = ecs.get_fields(fe, FieldsPos)
+assert(x == 1.5 and y == 2.5)
+
+ecs.set_fields(fe, FieldsPos, nil, 4)
+x, y = ecs.get_fields(fe, FieldsPos)
+assert(x == 1.5 and y == 4)
+
+ecs.set_fields(fe, FieldsBody, 1, 2, 30, true)
+assert(select("#", ecs.get_fields(fe, FieldsBody)) == 4)
+
+local b = ecs.get(fe, FieldsBody)
+assert(b.pos.x == 1 and b.pos.y == 2 and b.mass == 30 and b.alive == true)
+
+assert(ecs.get_fields(ecs.new(), FieldsPos) == nil)
+assert(not pcall(ecs.set_fields, fe, FieldsPos, "x"))
+assert(not pcall(ecs.get_fields, fe, ecs.lookup("lua_test_struct")))
+
+local hx = ecs.member(FieldsBody, "pos.x")
+local hmass = ecs.member(FieldsBody, "mass")
+
+assert(ecs.getm(fe, hx) == 1)
+ecs.setm(fe, hx, 10)
+ecs.setm(fe, hmass, 99)
+assert(ecs.get(fe, FieldsBody).pos.x == 10)
+assert(ecs.getm(fe, hmass) == 99)
+assert(ecs.getm(ecs.new(), hx) == nil)
+
+assert(not pcall(ecs.member, FieldsBody, "pos"))
+assert(not pcall(ecs.member, FieldsBody, "invalid"))
+assert(not pcall(ecs.getm, fe, {}))
+
+local function sys_member(it)
+    local b = it.columns[1]
+
+    for i = 1, it.count do
+        assert(it:getm(hmass, i) == 99)
+        it:setm(hmass, i, it:getm(hx, i) + 1)
+    end
+
+    --serialized rows are kept in sync
+    assert(b[1].mass == 11)
+    assert(not pcall(it.getm, it, ecs.member(FieldsPos, "x"), 1))
+    assert(not pcall(it.getm, it, hmass, it.count + 1))
+end
+
+ecs.run(ecs.system(sys_member, "sys_member", 0, "FieldsBody"), 1.0)
+
+assert(ecs.getm(fe, hmass) == 11)
+
+local function sys_member_each(it)
+    for b in ecs.each(it) do
+        --the row defaults to the current one
+        assert(it:getm(hmass) == b.mass)
+        it:setm(hmass, nil, b.pos.x + 5)
+        assert(b.mass == 15)
+    end
+
+    assert(not pcall(it.getm, it, hmass))
+end
+
+ecs.run(ecs.system(sys_member_each, "sys_member_each", 0, "FieldsBody"), 1.0)
+
+--not overwritten by the ecs.each() readback
+assert(ecs.getm(fe, hmass) == 15)
+
+local many = ecs.bulk_new(100)
+local many_values = {}
+
+for i = 1, #many do many_values[i] = { x = i, y = -i } end
+
+assert(ecs.set_many(many, FieldsPos, many_values) == 100)
+
+for i, e in ipairs(many) do
+    local p = ecs.get(e, FieldsPos)
+    assert(p.x == i and p.y == -i)
+end
+
+--one value for all entities, missing members are left unchanged
+ecs.set_many(many, FieldsPos, { y = 7 })
+
+for i, e in ipairs(many) do
+    local p = ecs.get(e, FieldsPos)
+    assert(p.x == i and p.y == 7)
+end
+
+ecs.set_many(many, FieldsBody, { pos = { x = 1 }, mass = 3 })
+assert(ecs.get(many[100], FieldsBody).mass == 3)
+
+assert(not pcall(ecs.set_many, { 0 }, FieldsPos, { x = 1 }))
+assert(not pcall(ecs.set_many, many, FieldsPos, { z = 1 }))
+
+local burst = ecs.bulk_new(0, 50, { [FieldsPos] = { x = 3, y = 4 }, [FieldsBody] = { mass = 2 } }, "range")
+
+assert(#burst == 50)
+assert(burst[0] == nil and burst[51] == nil and burst.x == nil)
+
+local burst_count = 0
+for i, e in ipairs(burst) do
+    burst_count = burst_count + 1
+    assert(ecs.get(e, FieldsPos).y == 4)
+    assert(ecs.get(e, FieldsBody).mass == 2)
+end
+assert(burst_count == 50)
+
+assert(ecs.set_many(burst, FieldsPos, { x = 1 }) == 50)
+assert(ecs.get(burst[50], FieldsPos).x == 1)
+
+local crowd_values = {}
+for i = 1, 20 do crowd_values[i] = { x = i } end
+
+local crowd = ecs.bulk_new(lua_test_comp, 20, { [FieldsPos] = crowd_values })
+
+for i, e in ipairs(crowd) do
+    assert(ecs.has(e, lua_test_comp))
+    assert(ecs.get(e, FieldsPos).x == i)
+end
+
+assert(ecs.bulk_new(0, 5, { [FieldsPos] = {} }, true) == nil)
+assert(not pcall(ecs.bulk_new, 0, 5, { [FieldsPos] = { z = 1 } }))
+assert(not pcall(ecs.bulk_new, 0, 5, { FieldsPos = {} }))
+assert(not pcall(ecs.bulk_new, 0, 5, {}, "table"))
+
+--type expressions are cached until entity names change
+local ExprA = ecs.tag("ExprA")
+local expr_e1 = ecs.new(nil, "ExprA")
+assert(ecs.has(expr_e1, ExprA))
+
+ecs.set_name(ExprA, nil)
+local ExprB = ecs.tag("ExprA")
+assert(ExprB ~= ExprA)
+
+local expr_e2 = ecs.new(nil, "ExprA")
+assert(ecs.has(expr_e2, ExprB) and not ecs.has(expr_e2, ExprA))
+assert(ecs.has(expr_e2, ecs.get_type("ExprA")))
+
+local expr_type = ecs.type("ExprType", "ExprA, FieldsPos")
+local expr_e3 = ecs.new()
+ecs.add(expr_e3, ecs.get_type(expr_type, true))
+assert(ecs.has(expr_e3, ExprB) and ecs.has(expr_e3, FieldsPos))
+
+--single-primitive components are bare values
+local Health = ecs.alias("flecs.meta.f32", "Health")
+local health_e = ecs.set(ecs.new(), Health, 10.5)
+assert(ecs.get(health_e, Health) == 10.5)
+assert(not pcall(ecs.set, health_e, Health, { value = 1 }))
+
+local healthy = ecs.bulk_new(0, 3, { [Health] = { 1, 2, 3 } })
+assert(ecs.get(healthy[3], Health) == 3)
+
+assert(ecs.set_many(healthy, Health, 100) == 3)
+assert(ecs.get(healthy[1], Health) == 100)
+
+ecs.set_many(healthy, Health, { 4, 5, 6 })
+assert(ecs.get(healthy[2], Health) == 5)
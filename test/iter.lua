@@ -48,6 +48,34 @@ print("total count: " .. count)
 
 assert(count > 10)
 
+--compiled filters are initialized once and reused
+local pos_filter = ecs.filter({ terms = Position })
+local expr_filter = ecs.filter("Position")
+
+for i = 1, 3 do
+    it = ecs.filter_iter(pos_filter)
+    pos_filter = nil
+    collectgarbage()
+
+    local n = 0
+    while ecs.filter_next(it) do n = n + it.count end
+    assert(n == ecs.count(expr_filter))
+
+    pos_filter = ecs.filter({ terms = Position })
+end
+
+assert(ecs.count(expr_filter) == ecs.count({ terms = Position }))
+assert(ecs.count(expr_filter) >= 36)
+
+local pos_q = ecs.query("Position")
+it = ecs.query_iter(pos_q)
+local n = 0
+while ecs.query_next(it, expr_filter) do n = n + it.count end
+assert(n == ecs.count(expr_filter))
+
+assert(not pcall(ecs.filter, {}))
+assert(not pcall(ecs.filter, "NotAComponent"))
+
 --[[ XXX: this should work on v3
 local ent = ecs.new("ent", "Velocity")
 
@@ -0,0 +1,53 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+local KPos = ecs.struct("KPos", "{float x; float y;}")
+local KVel = ecs.struct("KVel", "{float x; float y;}")
+local KBody = ecs.struct("KBody", "{KPos pos; int32_t hits; double mass;}")
+
+local N = 100
+local ents = ecs.bulk_new(N)
+
+for i, e in ipairs(ents) do
+    ecs.set(e, KPos, { x = i, y = i * 2 })
+    ecs.set(e, KVel, { x = 1, y = -2 })
+    ecs.set(e, KBody, { pos = { x = i }, hits = i, mass = 2 })
+end
+
+local move = ecs.kernel("KMove", 0, "KPos, [in] KVel", "KPos.x += KVel.x * $dt; KPos.y = KPos.y + KVel.y * $dt")
+
+ecs.run(move, 0.5)
+
+for i, e in ipairs(ents) do
+    local p = ecs.get(e, KPos)
+
+    assert(p.x == i + 0.5)
+    assert(p.y == i * 2 - 1)
+    --[in] terms are not written
+    assert(ecs.get(e, KVel).x == 1)
+end
+
+--nested members, integer conversion, precedence
+local body = ecs.kernel("KBodyK", 0, "KBody", "KBody.hits *= 2; KBody.pos.x = -(KBody.pos.x - 1) * KBody.mass + 3 / 2")
+
+ecs.run(body, 1.0)
+
+for i, e in ipairs(ents) do
+    local b = ecs.get(e, KBody)
+
+    assert(b.hits == i * 2)
+    assert(b.pos.x == -(i - 1) * 2 + 1.5)
+end
+
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos, [in] KVel", "KVel.x = 1"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", "KPos.z = 1"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", "KVel.x = 1"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", "KPos.x = $unknown"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", "KPos.x = (1"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", "KPos.x"))
+assert(not pcall(ecs.kernel, "KBad", 0, "KPos", ""))
+assert(not pcall(ecs.kernel, "KBad", 0, "KBody", "KBody.pos = 1"))
+assert(not pcall(ecs.kernel, "KBad", 0, string.rep("KPos", 33, ", "), "KPos.x = 1"))
@@ -1,7 +1,16 @@
 #include "test.h"
 
+#include <string.h>
+
+/* usage: e <script> [--builtin | --pool]
+
+   Scripts run on a state with the allocator below, with --builtin
+   they run on the state created by ecs_lua_get_state_w_flags(),
+   --pool creates it with ECS_LUA_POOL_ALLOC */
+
 static int custom_alloc;
 static size_t mem_usage;
+static lua_Integer alloc_count;
 
 void *Allocf(void *ud, void *ptr, size_t osize, size_t nsize)
 {
@@ -17,9 +26,18 @@ void *Allocf(void *ud, void *ptr, size_t osize, size_t nsize)
     }
 
     mem_usage += (nsize - osize);
+    alloc_count++;
+
     return ecs_os_realloc(ptr, nsize);
 }
 
+/* test.alloc_count(): number of (re)allocations so far */
+static int lalloc_count(lua_State *L)
+{
+    lua_pushinteger(L, alloc_count);
+    return 1;
+}
+
 static lua_State *new_test_state(void)
 {
     lua_State *L = lua_newstate(Allocf, NULL);
@@ -51,15 +69,26 @@ int main(int argc, char **argv)
 
     ECS_IMPORT(w, FlecsLua);
 
-    lua_State *L = ecs_lua_get_state(w);
+    bool builtin = false, pool = false;
+
+    int i;
+    for(i=2; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--builtin")) builtin = true;
+        else if(!strcmp(argv[i], "--pool")) builtin = pool = true;
+    }
+
+    /* Otherwise replaced below, creating and closing it exercises the pool allocator */
+    lua_State *L = ecs_lua_get_state_w_flags(w, builtin && !pool ? 0 : ECS_LUA_POOL_ALLOC);
 
     ecs_assert(L != NULL, ECS_INTERNAL_ERROR, NULL);
+    ecs_assert(L == ecs_lua_get_state(w), ECS_INTERNAL_ERROR, NULL);
 
-    L = new_test_state();
+    if(builtin) luaL_openlibs(L);
+    else L = new_test_state();
 
     lua_newtable(L);
 
-    int i;
     for(i=1; i < argc; i++)
     {
         lua_pushstring(L, argv[i]);
@@ -69,12 +98,25 @@ int main(int argc, char **argv)
     /* arg = { [0] = "<script_path>", ... } */
     lua_setglobal(L, "arg");
 
-    ecs_lua_set_state(w, L);
+    if(!builtin) ecs_lua_set_state(w, L);
 
     /* The pointer shouldn't change */
     ecs_assert(L == ecs_lua_get_state(w), ECS_INTERNAL_ERROR , NULL);
 
     luaL_requiref(L, "test", luaopen_test, 0);
+
+    if(!builtin)
+    {
+        lua_pushcfunction(L, lalloc_count);
+        lua_setfield(L, -2, "alloc_count");
+    }
+
+    lua_pushboolean(L, builtin);
+    lua_setfield(L, -2, "builtin");
+    lua_pushboolean(L, pool);
+    lua_setfield(L, -2, "pool");
+    lua_pushboolean(L, ecs_os_has_threading());
+    lua_setfield(L, -2, "threading");
     lua_pop(L, 1);
 
     int ret = luaL_dofile(L, argv[1]);
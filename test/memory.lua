@@ -0,0 +1,111 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+--Memory accounting of the built-in allocator, run with --builtin or --pool
+
+if not t.builtin then return end
+
+local mem = ecs.memory_stats()
+
+assert(mem.bytes > 0 and mem.count > 0)
+assert(mem.total >= mem.bytes)
+assert(mem.peak >= mem.bytes)
+assert(mem.owners.lua.entity == 0)
+assert(mem.owners.lua.bytes > 0)
+
+local stats = ecs.world_stats()
+assert(stats.lua_memory_bytes > 0 and stats.lua_memory_count > 0)
+
+--blocks are attributed to the running system
+local MemPos = ecs.struct("MemPos", "{float x; float y;}")
+
+ecs.set(ecs.new(), MemPos, { x = 1, y = 2 })
+
+local kept = {}
+
+local function MemSys(it)
+    for i = 1, 100 do kept[#kept + 1] = { i } end
+end
+
+local sys = ecs.system(MemSys, "MemSys", ecs.OnUpdate, "MemPos")
+
+ecs.progress(0)
+
+local owner = ecs.memory_stats().owners[ecs.fullpath(sys)]
+
+assert(owner and owner.entity == sys)
+assert(owner.count >= 100)
+assert(owner.bytes > 0 and owner.total >= owner.bytes)
+assert(ecs.get(sys, ecs.LuaSystemStats).alloc_bytes > 0)
+
+--and to the module being imported
+local module_data
+local m = {}
+
+local mod = ecs.module("MemModule", m, function ()
+    module_data = {}
+    for i = 1, 100 do module_data[i] = { i } end
+end)
+
+owner = ecs.memory_stats().owners[ecs.fullpath(mod)]
+
+assert(owner and owner.entity == mod)
+assert(owner.count >= 100)
+
+--freed blocks leave the owner
+kept = nil
+collectgarbage()
+
+owner = ecs.memory_stats().owners[ecs.fullpath(sys)]
+
+assert(owner == nil or owner.count < 100)
+
+--pooled blocks, run with --pool
+if not t.pool then return end
+
+mem = ecs.memory_stats()
+local pool = mem.pool
+
+assert(pool > 0)
+
+--blocks of every size class and beyond
+local blocks = {}
+
+for i = 1, 20000 do
+    blocks[i] = string.rep("p", i % 600) .. i
+end
+
+--growing tables move between classes and out of the pool
+local grown = {}
+
+for i = 1, 200 do
+    local a = {}
+    for j = 1, i do a[j] = j end
+    grown[i] = a
+end
+
+local grown_pool = ecs.memory_stats().pool
+
+assert(grown_pool > pool)
+
+for i = 1, 20000, 997 do
+    assert(blocks[i] == string.rep("p", i % 600) .. i)
+end
+
+for i = 1, 200 do
+    local a = grown[i]
+    assert(#a == i and a[1] == 1 and a[i] == i)
+end
+
+--empty slabs are released, a few are kept per class
+blocks = nil
+grown = nil
+collectgarbage()
+collectgarbage()
+
+mem = ecs.memory_stats()
+
+assert(mem.pool < grown_pool)
@@ -144,4 +144,56 @@ lol[ecs.get_type(LuaPosition)] = 245
 assert(not pcall(function () ecs.singleton_set(LuaPosition, lol) end))
 
 local str = ecs.emmy_class(LuaPosition)
-ecs.log(str)
\ No newline at end of file
+ecs.log(str)
+
+--Vectors are resized to the sequence, maps are replaced by the table
+local Inventory = ecs.struct("Inventory", "{ lua_test_vector weights; lua_test_mapi32 prices; int32_t gold; }")
+
+local items = {}
+for i = 1, 500 do items[i] = i * 0.5 end
+
+local inv = ecs.set(ecs.new(), Inventory, { weights = items, prices = { [1] = 10.5, [-2] = 3 }, gold = 7 })
+local v = ecs.get(inv, Inventory)
+
+assert(#v.weights == 500 and v.weights[500] == 250)
+assert(v.prices[1] == 10.5 and v.prices[-2] == 3)
+assert(v.gold == 7)
+
+ecs.set(inv, Inventory, { weights = { 1, 2 }, prices = { [5] = 1 } })
+v = ecs.get(inv, Inventory)
+
+assert(#v.weights == 2 and v.weights[2] == 2)
+assert(v.prices[5] == 1 and v.prices[1] == nil)
+assert(v.gold == 7)
+
+ecs.set(inv, Inventory, { weights = {}, prices = {} })
+v = ecs.get(inv, Inventory)
+assert(#v.weights == 0 and next(v.prices) == nil)
+
+assert(not pcall(ecs.set, inv, Inventory, { weights = { "a" } }))
+assert(not pcall(ecs.set, inv, Inventory, { prices = { a = 1 } }))
+assert(not pcall(ecs.set, inv, Inventory, { prices = { [0x80000000] = 1 } }))
+
+ecs.set(inv, Inventory, { weights = {}, prices = { [-0x80000000] = 1, [0x7fffffff] = 2 } })
+v = ecs.get(inv, Inventory)
+assert(v.prices[-0x80000000] == 1 and v.prices[0x7fffffff] == 2)
+
+--Dropped elements free their strings and nested vectors
+local Roster = ecs.struct("Roster", "{ lua_test_namedvec list; lua_test_mapnamed by_id; }")
+
+local roster = ecs.set(ecs.new(), Roster,
+{
+    list = { { name = "a", values = { 1 } }, { name = "b", values = { 2, 3 } }, { name = "c" } },
+    by_id = { [1] = { name = "x", values = { 4 } }, [2] = { name = "y" } }
+})
+
+ecs.set(roster, Roster, { list = { { name = "d" } }, by_id = { [3] = { name = "z", values = { 5, 6 } } } })
+local r = ecs.get(roster, Roster)
+
+assert(#r.list == 1 and r.list[1].name == "d")
+assert(r.by_id[3].name == "z" and #r.by_id[3].values == 2)
+assert(r.by_id[1] == nil and r.by_id[2] == nil)
+
+ecs.set(roster, Roster, { list = {}, by_id = {} })
+r = ecs.get(roster, Roster)
+assert(#r.list == 0 and next(r.by_id) == nil)
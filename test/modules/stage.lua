@@ -0,0 +1,25 @@
+local ecs = require "ecs"
+
+--Loaded by the main state and by ecs.load_stages()
+
+local m = {}
+
+--Components are shared, only the first state creates them
+m.StagePos = ecs.lookup("StagePos")
+
+if m.StagePos == 0 then
+    m.StagePos = ecs.struct("StagePos", "{float x; float y;}")
+end
+
+function m.move(it)
+    local stage = ecs.get_stage_id()
+
+    for p in ecs.each(it) do
+        p.x = p.x + 1
+        p.y = stage
+    end
+end
+
+m.StageMove = ecs.system(m.move, "StageMove", ecs.OnUpdate, "StagePos", { multi_threaded = true })
+
+return m
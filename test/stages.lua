@@ -0,0 +1,45 @@
+local t = require "test"
+local ecs = require "ecs"
+local u = require "util"
+
+u.test_defaults()
+
+if not t.threading then
+    print("no threading support, skipping")
+    return
+end
+
+ecs.set_threads(2)
+
+local m = require "modules.stage"
+local path = package.searchpath("modules.stage", package.path)
+
+assert(ecs.load_stages(path) == ecs.get_stage_count() - 1)
+
+--reloading rebinds the functions
+assert(ecs.load_stages(path) == ecs.get_stage_count() - 1)
+
+local N = 100
+local ents = ecs.bulk_new(m.StagePos, N)
+
+local frames = 3
+
+for i = 1, frames do
+    ecs.progress(0)
+end
+
+local stages = {}
+
+for i, e in ipairs(ents) do
+    local p = ecs.get(e, m.StagePos)
+
+    assert(p.x == frames)
+    stages[p.y] = true
+end
+
+--rows were split between the main and worker states
+assert(stages[0] and stages[1])
+
+assert(not pcall(ecs.load_stages, "does_not_exist.lua"))
+
+ecs.set_threads(1)
@@ -113,6 +113,25 @@ end
 
 ecs.system(sys_readonly, "sys_readonly", ecs.OnUpdate, "[in] Position, Velocity, LuaStruct")
 
+local function sys_in(it)
+    local p, v = ecs.columns(it)
+
+    --[in] terms carry the ecs_readonly metatable
+    assert(getmetatable(p) == false)
+    assert(getmetatable(v) == nil)
+    assert(not pcall(function () p[it.count + 1] = {} end))
+
+    for i = 1, it.count do
+        p[i].x = 0
+    end
+end
+
+ecs.run(ecs.system(sys_in, "sys_in", 0, "[in] Position, Velocity"), 1.0)
+
+for i, e in ipairs(ents) do
+    assert(ecs.get(e, Position).x == i * 10)
+end
+
 local custom_context = false
 
 local function sys_empty(it)
@@ -206,3 +225,331 @@ assert(triggered[ecs.OnRemove] > 0)
 
 
 assert(not pcall(function () ecs.observer(observer, "name", ecs.invalid_id, "LuaStruct") end))
+
+local ProxyPos = ecs.struct("ProxyPos", "{float x; float y;}")
+local ProxyBody = ecs.struct("ProxyBody", "{ProxyPos pos; int32_t mass; uint8_t tag[2];}")
+
+local proxy_ents = ecs.bulk_new(ProxyBody, 5)
+
+for i, e in ipairs(proxy_ents) do
+    ecs.set(e, ProxyBody, { pos = { x = i, y = i * 2 }, mass = i * 10 })
+end
+
+local stale
+
+local function sys_proxy(it)
+    local b = it.columns[1]
+
+    assert(type(b) == "userdata")
+    assert(#b == it.count)
+    assert(b == it.columns[1])
+
+    for i = 1, it.count do
+        local body = b[i]
+
+        assert(body.mass == i * 10)
+        assert(body.pos.x == i)
+        assert(body.pos.y == i * 2)
+
+        body.pos.x = body.pos.x + 1
+        body.pos = { y = 0 }
+        body.mass = body.mass + 1
+        body.tag = { 1, 2 }
+    end
+
+    assert(not pcall(function () return b[1].invalid end))
+    assert(not pcall(function () return b[it.count + 1] end))
+    assert(not pcall(function () b[1].mass = "string" end))
+
+    stale = b[1]
+end
+
+local sp = ecs.system(sys_proxy, "sys_proxy", 0, "ProxyBody", { proxy = true })
+
+ecs.run(sp, 1.0)
+
+for i, e in ipairs(proxy_ents) do
+    local body = ecs.get(e, ProxyBody)
+
+    assert(body.pos.x == i + 1)
+    assert(body.pos.y == 0)
+    assert(body.mass == i * 10 + 1)
+    assert(body.tag[1] == 1 and body.tag[2] == 2)
+end
+
+--views are only valid inside the callback
+assert(not pcall(function () return stale.mass end))
+
+local TrackBody = ecs.struct("TrackBody", "{ProxyPos pos; int32_t mass;}")
+
+local track_ents = ecs.bulk_new(TrackBody, 5)
+
+for i, e in ipairs(track_ents) do
+    ecs.set(e, TrackBody, { pos = { x = i, y = i }, mass = i })
+end
+
+local function sys_track(it)
+    local b = it.columns[1]
+
+    assert(#b == it.count)
+
+    for i = 1, it.count do
+        assert(b[i].mass == i)
+    end
+
+    b[2].mass = 20
+
+    --nested tables are written back when read
+    assert(b[3].pos.x == 3)
+    b[3].pos.y = 30
+
+    local fields = 0
+    for k, v in pairs(b[4]) do fields = fields + 1 end
+    assert(fields == 2)
+
+    assert(b[1].invalid == nil)
+    assert(b[it.count + 1] == nil)
+end
+
+local st = ecs.system(sys_track, "sys_track", 0, "TrackBody", { track = true })
+
+local stats = ecs.world_stats()
+
+ecs.run(st, 1.0)
+
+local stats2 = ecs.world_stats()
+
+--row 2 was assigned, row 3 (and 4 through pairs) had nested tables read
+assert(stats2.lua_rows_written - stats.lua_rows_written == 3)
+assert(stats2.lua_rows_skipped - stats.lua_rows_skipped == 2)
+
+for i, e in ipairs(track_ents) do
+    local body = ecs.get(e, TrackBody)
+
+    assert(body.mass == (i == 2 and 20 or i))
+    assert(body.pos.y == (i == 3 and 30 or i))
+end
+
+assert(not pcall(ecs.system, sys_track, "sys_track2", 0, "TrackBody", { track = true, proxy = true }))
+
+local FieldBody = ecs.struct("FieldBody", "{ProxyPos pos; int32_t mass;}")
+
+local field_ents = ecs.bulk_new(FieldBody, 5)
+
+for i, e in ipairs(field_ents) do
+    ecs.set(e, FieldBody, { pos = { x = i, y = i * 2 }, mass = i })
+    ecs.set(e, Velocity, { x = 1, y = 1 })
+end
+
+local function sys_field(it)
+    local x = it:field_array(1, "pos.x")
+    local m = ecs.field_array(it, 1, "mass")
+    local vx = it:field_array(2, "x")
+
+    assert(#x == it.count and #m == it.count)
+
+    for i = 1, it.count do
+        assert(x[i] == i)
+        assert(m[i] == i)
+        x[i] = x[i] + vx[i]
+        m[i] = m[i] * 10
+    end
+
+    --serialized rows are kept in sync with the written values
+    local b = it.columns[1]
+
+    it:set_field_array(1, "pos.x", x)
+    ecs.set_field_array(it, 1, "mass", m)
+
+    assert(b[1].pos.x == 2 and b[1].mass == 10)
+
+    assert(not pcall(it.field_array, it, 1, "pos"))
+    assert(not pcall(it.field_array, it, 1, "invalid"))
+    assert(not pcall(it.field_array, it, 3, "x"))
+    assert(not pcall(it.set_field_array, it, 1, "mass", {}))
+    assert(not pcall(it.set_field_array, it, 2, "x", vx))
+end
+
+ecs.run(ecs.system(sys_field, "sys_field", 0, "FieldBody, [in] Velocity"), 1.0)
+
+for i, e in ipairs(field_ents) do
+    local body = ecs.get(e, FieldBody)
+
+    assert(body.pos.x == i + 1)
+    assert(body.pos.y == i * 2)
+    assert(body.mass == i * 10)
+end
+
+--the reused iterator table is refilled after the callback changed it
+local reuse_runs = 0
+
+local function sys_reuse(it)
+    reuse_runs = reuse_runs + 1
+
+    assert(it.delta_time == 1.0)
+    assert(it.count == 5)
+    assert(it.entities[1] == field_ents[1])
+    assert(it.columns[1][1].mass > 0)
+
+    it.delta_time = 99
+    it.count = 0
+    it.entities = {}
+    it.columns = {}
+end
+
+local reuse_sys = ecs.system(sys_reuse, "sys_reuse", 0, "FieldBody, Velocity")
+
+ecs.run(reuse_sys, 1.0)
+ecs.run(reuse_sys, 1.0)
+
+assert(reuse_runs == 2)
+
+ecs.set(ecs.new(), FieldBody, { mass = 1 })
+
+local unset_terms = 0
+
+local function sys_field_opt(it)
+    if ecs.has(it.entities[1], Velocity) then
+        assert(#it:field_array(2, "x") == it.count)
+    else
+        unset_terms = unset_terms + 1
+        assert(not pcall(it.field_array, it, 2, "x"))
+        assert(not pcall(it.set_field_array, it, 2, "x", {}))
+    end
+end
+
+ecs.run(ecs.system(sys_field_opt, "sys_field_opt", 0, "FieldBody, ?Velocity"), 1.0)
+
+assert(unset_terms == 1)
+
+local Mana = ecs.alias("flecs.meta.i32", "Mana")
+
+local mana_ents = ecs.bulk_new(0, 5, { [Mana] = { 1, 2, 3, 4, 5 } })
+
+local function sys_mana(it)
+    local m = it.columns[1]
+
+    --plain array of values, even for proxied columns
+    assert(type(m) == "table" and #m == it.count)
+
+    for i = 1, it.count do
+        assert(m[i] == i)
+        m[i] = m[i] * 2
+    end
+
+    --ecs.each() yields copies, the column is written back when the callback returns
+    local n = 0
+    for v, e in ecs.each(it) do
+        n = n + 1
+        assert(v == n and e == mana_ents[n])
+    end
+    assert(n == it.count)
+end
+
+ecs.run(ecs.system(sys_mana, "sys_mana", 0, "Mana", { proxy = true }), 1.0)
+
+for i, e in ipairs(mana_ents) do
+    assert(ecs.get(e, Mana) == i * 2)
+end
+
+local StatsPos = ecs.struct("StatsPos", "{float x;}")
+
+ecs.bulk_new(StatsPos, 10)
+
+local function sys_stats(it)
+    local rows = {}
+    for i = 1, it.count do rows[i] = { i } end
+end
+
+local stats_sys = ecs.system(sys_stats, "sys_stats", ecs.OnUpdate, "StatsPos")
+
+assert(ecs.get(stats_sys, ecs.LuaSystemStats).invocations == 0)
+
+collectgarbage("stop")
+
+ecs.progress(0)
+ecs.progress(0)
+
+collectgarbage("restart")
+
+local sys_stats = ecs.get(stats_sys, ecs.LuaSystemStats)
+
+assert(sys_stats.invocations == 2)
+assert(sys_stats.rows == 20)
+assert(sys_stats.call_ns > 0)
+assert(sys_stats.serialize_ns >= 0 and sys_stats.readback_ns >= 0)
+assert(sys_stats.alloc_bytes > 0)
+assert(sys_stats.time.avg[sys_stats.t + 1] > 0)
+assert(sys_stats.time.max[sys_stats.t + 1] >= sys_stats.time.min[sys_stats.t + 1])
+
+assert(not pcall(ecs.trace_end))
+assert(not pcall(ecs.trace_begin, 0))
+
+ecs.trace_begin(1000)
+assert(not pcall(ecs.trace_begin, 1000))
+
+local trace_sys = ecs.system(function(it)
+    assert(not pcall(ecs.trace_begin, 1000))
+end, "trace_sys", ecs.OnUpdate, "StatsPos")
+
+ecs.progress(0)
+ecs.delete(trace_sys)
+
+local traced = ecs.trace_end()
+assert(traced > 0)
+
+--stopped
+ecs.progress(0)
+
+local trace_path = os.tmpname()
+assert(ecs.trace_dump(trace_path) == traced)
+
+local trace_file = io.open(trace_path)
+local json = trace_file:read("a")
+trace_file:close()
+os.remove(trace_path)
+
+assert(json:find('"name":"sys_stats","cat":"system"', 1, true))
+assert(json:find('"name":"call","cat":"lua"', 1, true))
+--recorded once by the frame systems
+local _, frames = json:gsub('"name":"frame","cat":"frame"', "")
+assert(frames == 1)
+
+assert(ecs.trace_dump("/nonexistent/trace.json") == nil)
+
+assert(not pcall(ecs.profiler_stop))
+assert(not pcall(ecs.profiler_start, 0))
+
+local function busy(it)
+    local t = os.clock() + 0.02
+    while os.clock() < t do end
+end
+
+local busy_sys = ecs.system(busy, "busy_sys", ecs.OnUpdate, "StatsPos")
+
+ecs.profiler_start(1000)
+ecs.progress(0)
+
+local folded, samples = ecs.profiler_stop()
+
+assert(samples > 0)
+assert(folded:find("busy_sys;", 1, true))
+
+local folded_total = 0
+
+for _, count in folded:gmatch("([^\n]+) (%d+)\n") do
+    folded_total = folded_total + tonumber(count)
+end
+
+assert(folded_total == samples)
+
+ecs.delete(busy_sys)
+
+--owners are only kept by the built-in allocator, see memory.lua
+local mem = ecs.memory_stats()
+
+assert(mem.bytes > 0)
+assert(mem.peak >= mem.bytes)
+assert(type(mem.owners) == "table")
+
+assert(ecs.world_stats().lua_memory_bytes > 0)
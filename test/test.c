@@ -97,6 +97,9 @@ void TestImport(ecs_world_t *w)
     ECS_META(w, lua_test_bitmask);
     ECS_META(w, lua_test_vector);
     ECS_META(w, lua_test_mapi32);
+    ECS_META(w, lua_test_named);
+    ECS_META(w, lua_test_namedvec);
+    ECS_META(w, lua_test_mapnamed);
     ECS_META(w, lua_test_struct);
 
     ecs_set_component_actions(w, lua_test_struct,
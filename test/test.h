@@ -35,6 +35,16 @@ ECS_VECTOR(lua_test_vector,float);
 
 ECS_MAP(lua_test_mapi32, int32_t, float);
 
+ECS_STRUCT(lua_test_named,
+{
+    char *name;
+    lua_test_vector values;
+});
+
+ECS_VECTOR(lua_test_namedvec, lua_test_named);
+
+ECS_MAP(lua_test_mapnamed, int32_t, lua_test_named);
+
 ECS_STRUCT(lua_test_struct,
 {
     bool b;